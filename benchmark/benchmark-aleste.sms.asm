@@ -1,4 +1,4 @@
-; { "technology": "Aleste", "extension": "aleste" }
+; { "technology": "Aleste", "extension": "aleste", "z80cycles": true }
 
 .memorymap
 defaultslot 0
@@ -1,4 +1,4 @@
-; { "technology": "aPLib (fast, apultra)", "extension": "apultra" }
+; { "technology": "aPLib (fast, apultra)", "extension": "apultra", "z80cycles": true }
 
 .memorymap
 defaultslot 0
@@ -1,4 +1,4 @@
-; { "technology": "LZ4", "extension": "lz4" }
+; { "technology": "LZ4", "extension": "lz4", "z80cycles": true }
 
 .memorymap
 defaultslot 0
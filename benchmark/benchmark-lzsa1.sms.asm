@@ -1,4 +1,4 @@
-; { "technology": "LZSA1", "extension": "lzsa1" }
+; { "technology": "LZSA1", "extension": "lzsa1", "z80cycles": true }
 
 .memorymap
 defaultslot 0
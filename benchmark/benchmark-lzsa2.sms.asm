@@ -1,4 +1,4 @@
-; { "technology": "LZSA2", "extension": "lzsa2" }
+; { "technology": "LZSA2", "extension": "lzsa2", "z80cycles": true }
 
 .memorymap
 defaultslot 0
@@ -1,4 +1,4 @@
-; { "technology": "Micro Machines", "extension": "mmcompr" }
+; { "technology": "Micro Machines", "extension": "mmcompr", "z80cycles": true }
 
 .memorymap
 defaultslot 0
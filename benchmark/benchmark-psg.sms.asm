@@ -1,4 +1,4 @@
-; { "technology": "Phantasy Star Gaiden", "extension": "psgcompr" }
+; { "technology": "Phantasy Star Gaiden", "extension": "psgcompr", "z80cycles": true }
 
 .memorymap
 defaultslot 0
@@ -1,4 +1,4 @@
-; { "technology": "Shining Force Gaiden", "extension": "sfg" }
+; { "technology": "Shining Force Gaiden", "extension": "sfg", "z80cycles": true }
 
 .memorymap
 defaultslot 0
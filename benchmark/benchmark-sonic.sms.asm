@@ -1,4 +1,4 @@
-; { "technology": "Sonic 1", "extension": "soniccompr" }
+; { "technology": "Sonic 1", "extension": "soniccompr", "z80cycles": true }
 
 .memorymap
 defaultslot 0
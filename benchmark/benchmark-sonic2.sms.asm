@@ -1,4 +1,4 @@
-; { "technology": "Sonic 2", "extension": "sonic2compr" }
+; { "technology": "Sonic 2", "extension": "sonic2compr", "z80cycles": true }
 
 .memorymap
 defaultslot 0
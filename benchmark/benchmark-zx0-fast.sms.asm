@@ -1,4 +1,4 @@
-; { "technology": "ZX0 (fast)", "extension": "zx0" }
+; { "technology": "ZX0 (fast)", "extension": "zx0", "z80cycles": true }
 
 .memorymap
 defaultslot 0
@@ -1,4 +1,4 @@
-; { "technology": "ZX7", "extension": "zx7" }
+; { "technology": "ZX7", "extension": "zx7", "z80cycles": true }
 
 .memorymap
 defaultslot 0
@@ -1,4 +1,5 @@
 import os
+import shutil
 import sys
 import subprocess
 import re
@@ -31,7 +32,7 @@ class Result:
         self.filename = filename
 
 
-def benchmark(technology, extension, rename_extension, asm_file, image_file):
+def benchmark(technology, extension, rename_extension, asm_file, image_file, z80cycles):
     try:
         data_file = f"data.{extension}"
 
@@ -90,6 +91,17 @@ def benchmark(technology, extension, rename_extension, asm_file, image_file):
 
         print(f"Test passed: {image_file} for {technology}. {os.stat('expected.bin').st_size}->{os.stat(data_file).st_size} in {cycles} cycles")
 
+        # Check the plugins' cycle estimate matches
+        if z80cycles is not None:
+            proc = subprocess.run([
+                z80cycles,
+                extension,
+                data_file],
+                check=True, capture_output=True, text=True)
+            estimate = int(proc.stdout.strip())
+            if estimate != cycles:
+                raise ValueError(f"Estimated {estimate} cycles for {image_file} for {technology}, but it took {cycles}")
+
         if is_test:
             return None
 
@@ -110,9 +122,17 @@ def benchmark(technology, extension, rename_extension, asm_file, image_file):
             # Some compressors fail if they can't compress the extreme test images, we ignore these
             return None
         return e
+    except ValueError as e:
+        print(e)
+        return e
 
 
 def compute():
+    # If we have the estimate checker, we use it for the benchmarks which ask for it
+    z80cycles = shutil.which("z80cycles")
+    if z80cycles is None:
+        print("z80cycles not found, not checking cycle estimates")
+
     results = []
     errors = []
     for benchmark_file in glob.glob("benchmark-*.asm"):
@@ -135,7 +155,8 @@ def compute():
                     test_extension,
                     extension,
                     benchmark_file,
-                    image)
+                    image,
+                    z80cycles if json_data.get("z80cycles", False) else None)
                 if isinstance(result, Result):
                     results.append(result)
                 elif isinstance(result, Exception):
@@ -329,6 +350,33 @@ def plot(results):
     return matplotlib.pyplot
 
 
+def speeds(results):
+    # Print the mean decompression speed of each format in cycles per byte, in the form of the [CyclesPerByte] section
+    # of a gfxcomp_best config. Formats with several decompressors get the fastest one.
+    extensions = {}
+    for benchmark_file in glob.glob("benchmark-*.asm"):
+        with open(benchmark_file) as file:
+            first_line = file.readline()
+        json_position = first_line.find("{")
+        if json_position < 0:
+            continue
+        json_data = json.loads(first_line[json_position:])
+        extensions.setdefault(json_data["technology"], set()).add(json_data["extension"])
+        extensions[json_data["technology"]].update(json_data.get("extra-extensions", []))
+
+    cycles_per_byte = {}
+    for technology, data in itertools.groupby(results, lambda r: r.technology):
+        if technology not in extensions:
+            continue
+        speed = statistics.mean([r.cycles / r.uncompressed for r in data])
+        for extension in extensions[technology]:
+            cycles_per_byte[extension] = min(speed, cycles_per_byte.get(extension, speed))
+
+    print("[CyclesPerByte]")
+    for extension, speed in sorted(cycles_per_byte.items()):
+        print(f"{extension}={speed:.1f}")
+
+
 def main():
     # Change to file's dir as we glob in here
     os.chdir(os.path.dirname(__file__))
@@ -367,4 +415,7 @@ def main():
             relative_speed = tiles_per_frame / reference_tiles_per_frame * 100
             print(f"{technology:{name_len + 2}}{rating:.1f}%\t{relative_speed:.2f}%")
 
+    if "speeds" in args:
+        speeds(data)
+
 main()
\ No newline at end of file
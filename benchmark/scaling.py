@@ -0,0 +1,182 @@
+import os
+import sys
+import math
+import json
+import random
+import subprocess
+import statistics
+
+# Checks how each compressor's time scales with the size of its input, which the benchmark corpus is too small to show.
+# We generate tile data from 1KB to 1MB with different structure, time every plugin on it using the throughput
+# program (see throughput.cpp), fit time = a * size ^ b for each, and flag any that look worse than O(n log n).
+#
+# Usage: py scaling.py <throughput program> <plugin directory> [generate] [run] [report]
+#
+# With no steps given, it does all of them. Results go in scaling-results.json.
+
+sizes = [1024 * 2 ** i for i in range(11)] # 1KB to 1MB
+# Once a plugin takes this long for one call, we don't try it on anything bigger
+time_limit_seconds = 10
+# n log n comes out at about 1.1 over the sizes we fit, so above this it is probably worse
+exponent_limit = 1.2
+# We only fit sizes from this up, as smaller ones are dominated by fixed costs
+fit_from_size = 16 * 1024
+# We don't flag anything whose slowest call is quicker than this, as memory cache effects swamp the fit
+min_flag_time_us = 10000
+
+
+def make_tile(pixels):
+    # Converts 64 pixel values (0..15) to 32 bytes of planar tile data, as used by the SMS and GG
+    result = bytearray()
+    for row in range(8):
+        for plane in range(4):
+            value = 0
+            for x in range(8):
+                value = (value << 1) | ((pixels[row * 8 + x] >> plane) & 1)
+            result.append(value)
+    return result
+
+
+def noise(rng, tile_count, colours):
+    # Every pixel is random, so the entropy is set by the number of colours
+    return b"".join(make_tile([rng.randrange(colours) for _ in range(64)]) for _ in range(tile_count))
+
+
+def runs(rng, tile_count, mean_run_length):
+    # Horizontal runs of random colours, with geometrically distributed lengths
+    pixels = []
+    while len(pixels) < tile_count * 64:
+        length = 1 + int(rng.expovariate(1 / mean_run_length))
+        pixels.extend([rng.randrange(16)] * length)
+    return b"".join(make_tile(pixels[i * 64:(i + 1) * 64]) for i in range(tile_count))
+
+
+def repeats(rng, tile_count, unique_tiles):
+    # Tiles chosen from a small set, like a typical tileset with the duplicates left in
+    tiles = [make_tile([rng.randrange(16) for _ in range(64)]) for _ in range(unique_tiles)]
+    return b"".join(rng.choice(tiles) for _ in range(tile_count))
+
+
+kinds = {
+    "noise16": lambda rng, tile_count: noise(rng, tile_count, 16),
+    "noise4": lambda rng, tile_count: noise(rng, tile_count, 4),
+    "runs4": lambda rng, tile_count: runs(rng, tile_count, 4),
+    "runs32": lambda rng, tile_count: runs(rng, tile_count, 32),
+    "repeats64": lambda rng, tile_count: repeats(rng, tile_count, 64),
+}
+
+
+def generate():
+    # Writes scaling/<size>/<kind>.bin. We seed each one so they are the same every time.
+    for size in sizes:
+        directory = os.path.join("scaling", str(size))
+        os.makedirs(directory, exist_ok=True)
+        for name, generator in kinds.items():
+            rng = random.Random(f"{name}.{size}")
+            with open(os.path.join(directory, f"{name}.bin"), "wb") as f:
+                f.write(generator(rng, size // 32))
+    print(f"Generated {len(kinds)} kinds of data at {len(sizes)} sizes")
+
+
+def run(throughput, plugin_directory):
+    results = []
+    plugins = sorted(
+        f for f in os.listdir(plugin_directory)
+        if "gfxcomp_" in f and os.path.splitext(f)[1] in [".dll", ".so"])
+    for plugin in plugins:
+        for size in sizes:
+            output = "scaling-plugin.json"
+            if os.path.exists(output):
+                os.remove(output)
+            proc = subprocess.run([
+                throughput,
+                "--runs", "1",
+                "--plugin", os.path.join(plugin_directory, plugin),
+                os.path.join("scaling", str(size)),
+                output],
+                capture_output=True, text=True)
+            if proc.returncode != 0 or not os.path.exists(output):
+                print(f"{plugin} failed at {size} bytes")
+                break
+            with open(output) as f:
+                size_results = [json.loads(line) for line in f]
+            os.remove(output)
+            results.extend(size_results)
+            slowest = max([r["median_us"] for r in size_results], default=0) / 1000000
+            print(f"{plugin}: {size} bytes in up to {slowest:.3f}s")
+            if slowest > time_limit_seconds:
+                print(f"{plugin} is too slow to try anything bigger")
+                break
+
+    with open("scaling-results.json", "w") as f:
+        json.dump(results, f)
+    return results
+
+
+def fit(points):
+    # Least squares fit of log(time) = log(a) + b log(size), returning b
+    large = [p for p in points if p[0] >= fit_from_size]
+    if len(large) >= 3:
+        points = large
+    if len(points) < 2:
+        return None
+    x = [math.log(size) for size, _ in points]
+    y = [math.log(time) for _, time in points]
+    return statistics.linear_regression(x, y).slope
+
+
+def report(results):
+    series = {}
+    for r in results:
+        kind = os.path.splitext(os.path.basename(r["filename"]))[0]
+        series.setdefault(r["technology"], {}).setdefault(kind, []).append((r["uncompressed"], r["median_us"]))
+
+    name_len = max([len(t) for t in series], default=0)
+    print(f"{'':{name_len + 2}}" + "".join(f"{kind:>11}" for kind in kinds))
+    flagged = []
+    for technology, by_kind in sorted(series.items()):
+        line = f"{technology:{name_len + 2}}"
+        for kind in kinds:
+            points = sorted(by_kind.get(kind, []))
+            exponent = fit(points)
+            if exponent is None:
+                line += f"{'-':>11}"
+                continue
+            warning = exponent > exponent_limit and max(t for _, t in points) >= min_flag_time_us
+            line += f"{exponent:>10.2f}{'!' if warning else ' '}"
+            if warning:
+                flagged.append(f"{technology} on {kind}")
+        print(line)
+
+    print(f"Exponents are b in time = a * size ^ b. Those marked ! are above {exponent_limit}, "
+          "so are probably worse than O(n log n):")
+    for f in flagged:
+        print(f"  {f}")
+
+
+def main():
+    if len(sys.argv) < 3:
+        print("Usage: py scaling.py <throughput program> <plugin directory> [generate] [run] [report]")
+        return 1
+
+    throughput = os.path.abspath(sys.argv[1])
+    plugin_directory = os.path.abspath(sys.argv[2])
+    # Change to file's dir as we work in here
+    os.chdir(os.path.dirname(os.path.abspath(__file__)))
+
+    args = ["generate", "run", "report"] if len(sys.argv) == 3 else sys.argv[3:]
+
+    if "generate" in args:
+        generate()
+
+    if "run" in args:
+        results = run(throughput, plugin_directory)
+    else:
+        with open("scaling-results.json", "r") as f:
+            results = json.load(f)
+
+    if "report" in args:
+        report(results)
+
+
+main()
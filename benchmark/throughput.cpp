@@ -0,0 +1,376 @@
+// Measures how fast the compressor plugins themselves run, as opposed to benchmark.py which measures how well they
+// compress and how fast the Z80 decompressors are. It loads each plugin in turn and calls it in-process on every
+// preconverted binary in the corpus: *.bin files are tiles, and *.tilemap.bin files are 32 entry wide tilemaps.
+//
+// Usage: throughput [--runs <n>] <plugin directory> [corpus directory] [output file]
+//
+// The corpus defaults to "corpus" and the output to "throughput-results.json", in the same form as
+// benchmark-results.json, with one entry per plugin and file giving the throughput in MB/s, median and 99th percentile
+// latency per call, and the peak memory use of the process. Each plugin runs in its own process (by running this
+// program again with --plugin) so the peak memory is its own, and so one crashing doesn't stop the rest.
+// Each call is timed at least 5 times (or as --runs says) and for at least 200ms.
+// The compression cache is disabled so we measure the compressors, not the cache.
+//
+// To build it:
+// Windows: cl /std:c++20 /O2 /EHsc throughput.cpp
+// Linux:   g++ -std=c++20 -O2 -o throughput throughput.cpp -ldl
+// The plugins need to be built for the same platform and bitness.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#include <Psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <dlfcn.h>
+#include <sys/resource.h>
+#endif
+
+namespace
+{
+    // We time calls until we have done at least this many (unless told otherwise), and spent at least this long...
+    constexpr std::size_t defaultMinimumRuns = 5;
+    constexpr auto minimumTime = std::chrono::milliseconds(200);
+    // ...but never more than this many, for the really fast ones
+    constexpr std::size_t maximumRuns = 1000;
+
+    constexpr int tilemapWidth = 32;
+
+    using GetName = const char*(*)();
+    using GetMaxCompressedSize = uint32_t(*)(uint32_t, bool);
+    using CompressTiles = int32_t(*)(const uint8_t*, uint32_t, uint8_t*, uint32_t);
+    using CompressTilemap = int32_t(*)(const uint8_t*, uint32_t, uint32_t, uint8_t*, uint32_t);
+
+    class Library
+    {
+    public:
+        explicit Library(const std::filesystem::path& path)
+        {
+#ifdef _WIN32
+            _handle = LoadLibraryW(path.c_str());
+#else
+            _handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+#endif
+        }
+
+        Library(const Library&) = delete;
+        Library& operator=(const Library&) = delete;
+
+        ~Library()
+        {
+            if (_handle == nullptr)
+            {
+                return;
+            }
+#ifdef _WIN32
+            FreeLibrary(_handle);
+#else
+            dlclose(_handle);
+#endif
+        }
+
+        [[nodiscard]]
+        bool isLoaded() const
+        {
+            return _handle != nullptr;
+        }
+
+        template <typename T>
+        T get(const char* name) const
+        {
+#ifdef _WIN32
+            return reinterpret_cast<T>(GetProcAddress(_handle, name));
+#else
+            return reinterpret_cast<T>(dlsym(_handle, name));
+#endif
+        }
+
+    private:
+#ifdef _WIN32
+        HMODULE _handle;
+#else
+        void* _handle;
+#endif
+    };
+
+    // Peak memory use of this process so far, in KB
+    uint64_t getPeakMemoryKilobytes()
+    {
+#ifdef _WIN32
+        PROCESS_MEMORY_COUNTERS counters{};
+        GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+        return counters.PeakWorkingSetSize / 1024;
+#else
+        rusage usage{};
+        getrusage(RUSAGE_SELF, &usage);
+        return static_cast<uint64_t>(usage.ru_maxrss);
+#endif
+    }
+
+    void disableCompressionCache()
+    {
+#ifdef _WIN32
+        _putenv("GFXCOMP_CACHE_DIR=");
+#else
+        unsetenv("GFXCOMP_CACHE_DIR");
+#endif
+    }
+
+    bool isPlugin(const std::filesystem::path& path)
+    {
+#ifdef _WIN32
+        const auto extension = ".dll";
+#else
+        const auto extension = ".so";
+#endif
+        const auto stem = path.stem().string();
+        return path.extension() == extension && (stem.starts_with("gfxcomp_") || stem.starts_with("libgfxcomp_"));
+    }
+
+    std::string escape(const std::string& s)
+    {
+        std::string result;
+        for (const auto c : s)
+        {
+            if (c == '"' || c == '\\')
+            {
+                result += '\\';
+            }
+            result += c;
+        }
+        return result;
+    }
+
+    struct CorpusFile
+    {
+        std::string filename;
+        std::vector<uint8_t> data;
+        bool isTilemap;
+    };
+
+    std::vector<CorpusFile> loadCorpus(const std::filesystem::path& directory)
+    {
+        std::vector<CorpusFile> result;
+        for (const auto& entry : std::filesystem::directory_iterator(directory))
+        {
+            if (entry.path().extension() != ".bin")
+            {
+                continue;
+            }
+            std::ifstream f(entry.path(), std::ios::binary);
+            result.push_back({
+                .filename = (directory / entry.path().filename()).string(),
+                .data = std::vector<uint8_t>(std::istreambuf_iterator(f), {}),
+                .isTilemap = entry.path().stem().extension() == ".tilemap"
+            });
+        }
+        std::ranges::sort(result, {}, &CorpusFile::filename);
+        return result;
+    }
+
+    // Runs one plugin over the corpus and writes a line of JSON for each file it can compress to the output file
+    int benchmarkPlugin(
+        const std::filesystem::path& pluginPath,
+        const std::filesystem::path& corpusDirectory,
+        const std::filesystem::path& outputPath,
+        const std::size_t minimumRuns)
+    {
+        disableCompressionCache();
+        const auto corpus = loadCorpus(corpusDirectory);
+        const Library plugin(pluginPath);
+        if (!plugin.isLoaded())
+        {
+            printf("Failed to load %s\n", pluginPath.string().c_str());
+            return 1;
+        }
+        const auto getName = plugin.get<GetName>("getName");
+        const auto getMaxCompressedSize = plugin.get<GetMaxCompressedSize>("getMaxCompressedSize");
+        const auto compressTiles = plugin.get<CompressTiles>("compressTiles");
+        const auto compressTilemap = plugin.get<CompressTilemap>("compressTilemap");
+        const std::string name = getName == nullptr ? pluginPath.stem().string() : getName();
+
+        struct Result
+        {
+            const CorpusFile& file;
+            int32_t compressedSize;
+            std::vector<double> microseconds;
+        };
+        std::vector<Result> results;
+        for (const auto& file : corpus)
+        {
+            const auto size = static_cast<uint32_t>(file.data.size());
+            auto compress = [&](uint8_t* pDestination, const uint32_t destinationLength)
+            {
+                if (file.isTilemap)
+                {
+                    return compressTilemap == nullptr
+                        ? -1
+                        : compressTilemap(
+                            file.data.data(),
+                            tilemapWidth,
+                            size / 2 / tilemapWidth,
+                            pDestination,
+                            destinationLength);
+                }
+                return compressTiles == nullptr
+                    ? -1
+                    : compressTiles(file.data.data(), size / 32, pDestination, destinationLength);
+            };
+
+            // The first call tells us the size, and also warms up the caches
+            uint32_t capacity = getMaxCompressedSize == nullptr ? 0 : getMaxCompressedSize(size, file.isTilemap);
+            if (capacity == 0)
+            {
+                capacity = size * 2 + 1024;
+            }
+            std::vector<uint8_t> destination(capacity);
+            auto compressedSize = compress(destination.data(), capacity);
+            while (compressedSize == 0 && destination.size() < size * 64ull)
+            {
+                destination.resize(destination.size() * 4);
+                compressedSize = compress(destination.data(), static_cast<uint32_t>(destination.size()));
+            }
+            if (compressedSize <= 0)
+            {
+                continue;
+            }
+
+            Result result{.file = file, .compressedSize = compressedSize, .microseconds = {}};
+            const auto start = std::chrono::steady_clock::now();
+            while (result.microseconds.size() < maximumRuns
+                && (result.microseconds.size() < minimumRuns || std::chrono::steady_clock::now() - start < minimumTime))
+            {
+                const auto before = std::chrono::steady_clock::now();
+                compress(destination.data(), static_cast<uint32_t>(destination.size()));
+                const auto after = std::chrono::steady_clock::now();
+                result.microseconds.push_back(std::chrono::duration<double, std::micro>(after - before).count());
+            }
+            results.push_back(std::move(result));
+        }
+
+        // We measure this last so it covers all the work
+        const auto peakMemory = getPeakMemoryKilobytes();
+        std::ofstream output(outputPath);
+        for (auto& [file, compressedSize, microseconds] : results)
+        {
+            double total = 0;
+            for (const auto time : microseconds)
+            {
+                total += time;
+            }
+            std::ranges::sort(microseconds);
+            const auto median = microseconds[microseconds.size() / 2];
+            const auto p99 = microseconds[std::min(microseconds.size() - 1, microseconds.size() * 99 / 100)];
+            const auto uncompressed = file.data.size();
+            // Bytes per microsecond is MB/s
+            const auto megabytesPerSecond = static_cast<double>(uncompressed * microseconds.size()) / total;
+            char buffer[1024];
+            snprintf(
+                buffer,
+                sizeof(buffer),
+                R"({"technology": "%s", "uncompressed": %zu, "compressed": %d, "ratio": %.6f, )"
+                R"("megabytes_per_second": %.3f, "median_us": %.1f, "p99_us": %.1f, "peak_rss_kb": %llu, )"
+                R"("runs": %zu, "filename": "%s"})",
+                escape(name).c_str(),
+                uncompressed,
+                compressedSize,
+                1.0 - static_cast<double>(compressedSize) / static_cast<double>(uncompressed),
+                megabytesPerSecond,
+                median,
+                p99,
+                static_cast<unsigned long long>(peakMemory),
+                microseconds.size(),
+                escape(file.filename).c_str());
+            output << buffer << '\n';
+            printf("%s: %s at %.3f MB/s\n", name.c_str(), file.filename.c_str(), megabytesPerSecond);
+        }
+        return 0;
+    }
+
+    std::string quote(const std::string& s)
+    {
+        return '"' + s + '"';
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const std::string program = argv[0];
+    std::string runs = std::to_string(defaultMinimumRuns);
+    if (argc > 2 && std::string(argv[1]) == "--runs")
+    {
+        runs = argv[2];
+        argc -= 2;
+        argv += 2;
+    }
+    const auto minimumRuns = std::max<std::size_t>(1, std::strtoul(runs.c_str(), nullptr, 10));
+    if (argc == 5 && std::string(argv[1]) == "--plugin")
+    {
+        return benchmarkPlugin(argv[2], argv[3], argv[4], minimumRuns);
+    }
+    if (argc < 2)
+    {
+        printf("Usage: %s [--runs <n>] <plugin directory> [corpus directory] [output file]\n", program.c_str());
+        return 1;
+    }
+    const std::filesystem::path pluginDirectory = argv[1];
+    const std::filesystem::path corpusDirectory = argc > 2 ? argv[2] : "corpus";
+    const std::filesystem::path outputPath = argc > 3 ? argv[3] : "throughput-results.json";
+
+    std::vector<std::filesystem::path> plugins;
+    for (const auto& entry : std::filesystem::directory_iterator(pluginDirectory))
+    {
+        if (isPlugin(entry.path()))
+        {
+            plugins.push_back(entry.path());
+        }
+    }
+    std::ranges::sort(plugins);
+
+    std::vector<std::string> entries;
+    const auto temporaryPath = std::filesystem::temp_directory_path() / "throughput-plugin.json";
+    for (const auto& plugin : plugins)
+    {
+        std::filesystem::remove(temporaryPath);
+        auto command = quote(program) + " --runs " + std::to_string(minimumRuns) + " --plugin " + quote(plugin.string())
+            + " " + quote(corpusDirectory.string()) + " " + quote(temporaryPath.string());
+#ifdef _WIN32
+        // cmd.exe strips the outer quotes if the command starts with one
+        command = quote(command);
+#endif
+        fflush(stdout);
+        if (std::system(command.c_str()) != 0)
+        {
+            printf("Failed to benchmark %s\n", plugin.string().c_str());
+            continue;
+        }
+        std::ifstream f(temporaryPath);
+        for (std::string line; std::getline(f, line);)
+        {
+            entries.push_back(line);
+        }
+    }
+    std::filesystem::remove(temporaryPath);
+
+    std::ofstream output(outputPath);
+    output << '[';
+    for (std::size_t i = 0; i < entries.size(); ++i)
+    {
+        output << (i == 0 ? "" : ", ") << entries[i];
+    }
+    output << ']';
+    printf("Wrote %zu results to %s\n", entries.size(), outputPath.string().c_str());
+    return 0;
+}
@@ -0,0 +1,56 @@
+// Prints the cycle estimate from Z80Cycles for some compressed files, so it can be checked against the decompressors
+// running in z80bench. benchmark.py does this for any benchmark marked with "z80cycles" in its metadata, when it can
+// find this program.
+//
+// Usage: z80cycles <format> <file>...
+//
+// format is the extension of the plugin which made the files. It prints the number of cycles for each file, one per
+// line, or -1 if the format is not supported or the file is not valid.
+//
+// To build it:
+// Windows: cl /std:c++20 /O2 /EHsc z80cycles.cpp ..\compressors\Z80Cycles.cpp
+// Linux:   g++ -std=c++20 -O2 -o z80cycles z80cycles.cpp ../compressors/Z80Cycles.cpp
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "../compressors/Z80Cycles.h"
+
+int main(int argc, char** argv)
+{
+    if (argc < 3)
+    {
+        printf("Usage: %s <format> <file>...\n", argv[0]);
+        return 1;
+    }
+    const std::string format = argv[1];
+    if (!Z80Cycles::isSupported(format))
+    {
+        printf("Format %s is not supported\n", format.c_str());
+        return 1;
+    }
+
+    int result = 0;
+    for (int i = 2; i < argc; ++i)
+    {
+        std::ifstream f(argv[i], std::ios::binary);
+        if (!f)
+        {
+            printf("Failed to read %s\n", argv[i]);
+            result = 1;
+            continue;
+        }
+        const std::vector<uint8_t> data{std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>()};
+        const auto cycles = Z80Cycles::estimate(format, data.data(), static_cast<uint32_t>(data.size()));
+        printf("%lld\n", static_cast<long long>(cycles));
+        if (cycles < 0)
+        {
+            result = 1;
+        }
+    }
+    return result;
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include <cstdint>
+
+// The default compressTilesBatch() export, which loops over the plugin's own compressTiles(). Every plugin which
+// exports compressTiles() includes this in exactly one of its source files, so they all have it whether or not they
+// link the utils library. gfxcomp_exe has its own, which runs the items in parallel.
+
+extern "C" __declspec(dllexport) int32_t compressTiles(
+    const uint8_t* pSource,
+    uint32_t numTiles,
+    uint8_t* pDestination,
+    uint32_t destinationLength);
+
+// Compresses many sets of tiles in one call, for hosts with lots of small assets. Item i compresses numTiles[i] tiles
+// from pSources[i] into pDestinations[i], which has space for destinationLengths[i] bytes, and puts the result that
+// compressTiles() would return into pResults[i]. Returns the number of items which compressed successfully.
+extern "C" __declspec(dllexport) int32_t compressTilesBatch(
+    const uint8_t* const* pSources,
+    const uint32_t* numTiles,
+    uint8_t* const* pDestinations,
+    const uint32_t* destinationLengths,
+    int32_t* pResults,
+    const uint32_t count)
+{
+    int32_t successCount = 0;
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        pResults[i] = compressTiles(pSources[i], numTiles[i], pDestinations[i], destinationLengths[i]);
+        if (pResults[i] > 0)
+        {
+            ++successCount;
+        }
+    }
+    return successCount;
+}
@@ -0,0 +1,343 @@
+#include "CompressionCache.h"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <unordered_map>
+#include <vector>
+
+#include "utils.h"
+
+namespace
+{
+    constexpr uint32_t fileMagic = 0x43584647; // "GFXC"
+
+    uint64_t mix(uint64_t h)
+    {
+        // The splitmix64 finaliser
+        h ^= h >> 30;
+        h *= 0xbf58476d1ce4e5b9ull;
+        h ^= h >> 27;
+        h *= 0x94d049bb133111ebull;
+        h ^= h >> 31;
+        return h;
+    }
+
+    // A fast non-cryptographic hash, working on 8 bytes at a time
+    uint64_t hash(const uint8_t* pData, const std::size_t length, const uint64_t seed)
+    {
+        uint64_t h = seed ^ (length * 0x9e3779b97f4a7c15ull);
+        std::size_t i = 0;
+        for (; i + 8 <= length; i += 8)
+        {
+            uint64_t value;
+            std::memcpy(&value, pData + i, sizeof(value));
+            h = std::rotl(h ^ (value * 0xc2b2ae3d27d4eb4full), 31) * 0x9e3779b97f4a7c15ull;
+        }
+        uint64_t tail = 0;
+        for (; i < length; ++i)
+        {
+            tail = (tail << 8) | pData[i];
+        }
+        return mix(h ^ (tail * 0x165667b19e3779f9ull));
+    }
+
+    uint64_t hash(const std::string& s, const uint64_t seed)
+    {
+        return hash(reinterpret_cast<const uint8_t*>(s.data()), s.size(), seed);
+    }
+
+    std::string getEnvironmentVariable(const char* name)
+    {
+#pragma warning(suppress: 4996) // We copy the result straight away
+        const char* value = std::getenv(name);
+        return value == nullptr ? "" : value;
+    }
+
+    // Each result is in a file named by the hash of its key and source data. The file holds the key and a second hash
+    // of the source so we can check it is the right one, then the compressed data. We keep an index of the files in
+    // memory so we can remove the least recently used ones when the cache gets too big.
+    class Cache
+    {
+    public:
+        static Cache& instance()
+        {
+            static Cache cache;
+            return cache;
+        }
+
+        [[nodiscard]]
+        bool isEnabled() const
+        {
+            return !_directory.empty();
+        }
+
+        bool tryGet(
+            const std::string& key,
+            const uint8_t* pSource,
+            const uint32_t sourceLength,
+            uint8_t* pDestination,
+            const uint32_t destinationLength,
+            int32_t& result)
+        {
+            const auto id = getId(key, pSource, sourceLength);
+            std::ifstream file(getPath(id), std::ios::binary);
+            std::vector<uint8_t> data;
+            if (!file || !readEntry(file, key, pSource, sourceLength, data))
+            {
+                ++_misses;
+                return false;
+            }
+            ++_hits;
+            result = data.size() > destinationLength
+                ? ReturnValues::BufferTooSmall
+                : static_cast<int32_t>(data.size());
+            std::ranges::copy_n(data.begin(), result, pDestination);
+
+            // Mark it as recently used, on disk too, so other processes know
+            const std::scoped_lock lock(_mutex);
+            std::error_code error;
+            std::filesystem::last_write_time(getPath(id), std::filesystem::file_time_type::clock::now(), error);
+            if (const auto it = _entries.find(id); it != _entries.end())
+            {
+                it->second.lastUsed = ++_clock;
+            }
+            return true;
+        }
+
+        void put(
+            const std::string& key,
+            const uint8_t* pSource,
+            const uint32_t sourceLength,
+            const uint8_t* pCompressed,
+            const uint32_t compressedLength)
+        {
+            const auto id = getId(key, pSource, sourceLength);
+            const auto path = getPath(id);
+            // We write to a temporary file and rename it, so other processes never see a partial file
+            auto tempPath = path;
+            tempPath += "." + std::to_string(std::random_device()()) + ".tmp";
+            {
+                std::ofstream file(tempPath, std::ios::binary);
+                const auto keyLength = static_cast<uint32_t>(key.size());
+                const auto sourceHash = hash(pSource, sourceLength, 0);
+                write(file, fileMagic);
+                write(file, sourceLength);
+                write(file, sourceHash);
+                write(file, keyLength);
+                file.write(key.data(), keyLength);
+                write(file, compressedLength);
+                file.write(reinterpret_cast<const char*>(pCompressed), compressedLength);
+                if (!file)
+                {
+                    file.close();
+                    std::error_code error;
+                    std::filesystem::remove(tempPath, error);
+                    return;
+                }
+            }
+            std::error_code error;
+            std::filesystem::rename(tempPath, path, error);
+            if (error)
+            {
+                std::filesystem::remove(tempPath, error);
+                return;
+            }
+
+            const std::scoped_lock lock(_mutex);
+            auto& entry = _entries[id];
+            _totalBytes -= entry.size;
+            entry = {.size = std::filesystem::file_size(path, error), .lastUsed = ++_clock};
+            if (error)
+            {
+                entry.size = 0;
+            }
+            _totalBytes += entry.size;
+            evict();
+        }
+
+        [[nodiscard]]
+        uint64_t hits() const
+        {
+            return _hits;
+        }
+
+        [[nodiscard]]
+        uint64_t misses() const
+        {
+            return _misses;
+        }
+
+    private:
+        struct Entry
+        {
+            uint64_t size;
+            uint64_t lastUsed;
+        };
+
+        Cache()
+        {
+            const auto directory = getEnvironmentVariable("GFXCOMP_CACHE_DIR");
+            if (directory.empty())
+            {
+                return;
+            }
+            std::error_code error;
+            std::filesystem::create_directories(directory, error);
+            if (!std::filesystem::is_directory(directory, error))
+            {
+                printf("Can't use cache directory %s\n", directory.c_str());
+                return;
+            }
+            _directory = directory;
+            const auto maxMegabytes = getEnvironmentVariable("GFXCOMP_CACHE_MAX_MB");
+            _maxBytes = (maxMegabytes.empty() ? 256 : std::strtoull(maxMegabytes.c_str(), nullptr, 10)) * 1024 * 1024;
+
+            // Index what is already there, ordered by when it was last used
+            std::vector<std::pair<std::filesystem::file_time_type, uint64_t>> byTime;
+            for (const auto& file : std::filesystem::directory_iterator(_directory, error))
+            {
+                if (file.path().extension() != ".gfxc")
+                {
+                    continue;
+                }
+                uint64_t id;
+                std::istringstream ss(file.path().stem().string());
+                if (!(ss >> std::hex >> id))
+                {
+                    continue;
+                }
+                const auto size = file.file_size(error);
+                if (error)
+                {
+                    continue;
+                }
+                _entries[id] = {.size = size, .lastUsed = 0};
+                _totalBytes += size;
+                byTime.emplace_back(file.last_write_time(error), id);
+            }
+            std::ranges::sort(byTime);
+            for (const auto& [time, id] : byTime)
+            {
+                _entries[id].lastUsed = ++_clock;
+            }
+            evict();
+        }
+
+        static uint64_t getId(const std::string& key, const uint8_t* pSource, const uint32_t sourceLength)
+        {
+            return hash(pSource, sourceLength, hash(key, 0));
+        }
+
+        [[nodiscard]]
+        std::filesystem::path getPath(const uint64_t id) const
+        {
+            std::ostringstream ss;
+            ss << std::hex << id << ".gfxc";
+            return _directory / ss.str();
+        }
+
+        template <typename T>
+        static void write(std::ofstream& file, const T& value)
+        {
+            file.write(reinterpret_cast<const char*>(&value), sizeof(T));
+        }
+
+        template <typename T>
+        static bool read(std::ifstream& file, T& value)
+        {
+            return static_cast<bool>(file.read(reinterpret_cast<char*>(&value), sizeof(T)));
+        }
+
+        static bool readEntry(
+            std::ifstream& file,
+            const std::string& key,
+            const uint8_t* pSource,
+            const uint32_t sourceLength,
+            std::vector<uint8_t>& data)
+        {
+            uint32_t magic;
+            uint32_t length;
+            uint64_t sourceHash;
+            if (!read(file, magic) || magic != fileMagic
+                || !read(file, length) || length != sourceLength
+                || !read(file, sourceHash) || sourceHash != hash(pSource, sourceLength, 0)
+                || !read(file, length) || length != key.size())
+            {
+                return false;
+            }
+            std::string fileKey(length, '\0');
+            if (!file.read(fileKey.data(), length) || fileKey != key || !read(file, length))
+            {
+                return false;
+            }
+            data.resize(length);
+            return static_cast<bool>(file.read(reinterpret_cast<char*>(data.data()), length));
+        }
+
+        // Removes the least recently used entries until we fit. The caller must hold the lock.
+        void evict()
+        {
+            while (_totalBytes > _maxBytes && !_entries.empty())
+            {
+                const auto it = std::ranges::min_element(
+                    _entries,
+                    [](const auto& a, const auto& b) { return a.second.lastUsed < b.second.lastUsed; });
+                std::error_code error;
+                std::filesystem::remove(getPath(it->first), error);
+                _totalBytes -= it->second.size;
+                _entries.erase(it);
+            }
+        }
+
+        std::filesystem::path _directory;
+        uint64_t _maxBytes = 0;
+        std::mutex _mutex;
+        std::unordered_map<uint64_t, Entry> _entries;
+        uint64_t _totalBytes = 0;
+        uint64_t _clock = 0;
+        std::atomic<uint64_t> _hits = 0;
+        std::atomic<uint64_t> _misses = 0;
+    };
+}
+
+bool CompressionCache::tryGet(
+    const std::string& key,
+    const uint8_t* pSource,
+    const uint32_t sourceLength,
+    uint8_t* pDestination,
+    const uint32_t destinationLength,
+    int32_t& result)
+{
+    auto& cache = Cache::instance();
+    return cache.isEnabled() && cache.tryGet(key, pSource, sourceLength, pDestination, destinationLength, result);
+}
+
+void CompressionCache::put(
+    const std::string& key,
+    const uint8_t* pSource,
+    const uint32_t sourceLength,
+    const uint8_t* pCompressed,
+    const uint32_t compressedLength)
+{
+    if (auto& cache = Cache::instance(); cache.isEnabled())
+    {
+        cache.put(key, pSource, sourceLength, pCompressed, compressedLength);
+    }
+}
+
+// Gets the number of cache hits and misses since the plugin was loaded. Both are 0 if the cache is not enabled.
+extern "C" __declspec(dllexport) void getCacheStats(uint64_t* pHits, uint64_t* pMisses)
+{
+    const auto& cache = Cache::instance();
+    *pHits = cache.hits();
+    *pMisses = cache.misses();
+}
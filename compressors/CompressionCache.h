@@ -0,0 +1,52 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+// An optional on-disk cache of compression results, so slow compressors don't need to compress unchanged data again.
+// It is only used if the environment variable GFXCOMP_CACHE_DIR names a directory to keep it in. GFXCOMP_CACHE_MAX_MB
+// limits its size (default 256), removing the least recently used results first. The directory can be shared by
+// multiple processes. Plugins using it also export getCacheStats() so hosts can see how well it is working.
+class CompressionCache
+{
+public:
+    // Gets the compressed data for pSource from the cache, or calls compress(pDestination, destinationLength) and adds
+    // its result to the cache if it succeeds. key must describe everything else which affects the output: the
+    // compressor, its parameters and a version number to change when its output changes.
+    template <typename F>
+    static int32_t compress(
+        const std::string& key,
+        const uint8_t* pSource,
+        const uint32_t sourceLength,
+        uint8_t* pDestination,
+        const uint32_t destinationLength,
+        F&& compress)
+    {
+        int32_t result;
+        if (tryGet(key, pSource, sourceLength, pDestination, destinationLength, result))
+        {
+            return result;
+        }
+        result = compress(pDestination, destinationLength);
+        if (result > 0)
+        {
+            put(key, pSource, sourceLength, pDestination, static_cast<uint32_t>(result));
+        }
+        return result;
+    }
+
+private:
+    static bool tryGet(
+        const std::string& key,
+        const uint8_t* pSource,
+        uint32_t sourceLength,
+        uint8_t* pDestination,
+        uint32_t destinationLength,
+        int32_t& result);
+
+    static void put(
+        const std::string& key,
+        const uint8_t* pSource,
+        uint32_t sourceLength,
+        const uint8_t* pCompressed,
+        uint32_t compressedLength);
+};
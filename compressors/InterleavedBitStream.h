@@ -1,25 +1,24 @@
 #pragma once
 #include <vector>
 
+#include "OutputSink.h"
+
 // Implements a buffer where there are bytes containing a bitstream interleaved with a byte stream.
+// The data goes straight to an OutputSink.
 class InterleavedBitStream
 {
-    std::vector<unsigned char> m_buffer;
+    OutputSink& m_sink;
     std::size_t m_currentOffset = 0;
+    uint8_t m_currentBits = 0;
     int m_bitsLeft = 0;
     bool m_rightToLeft;
 
 public:
-    InterleavedBitStream(bool rightToLeft = false);
+    InterleavedBitStream(OutputSink& sink, bool rightToLeft = false);
 
     void addBit(int bit);
 
     void addByte(int b);
 
     void addBytes(const std::vector<uint8_t>& source, size_t offset, int count);
-
-    [[nodiscard]] const std::vector<unsigned char>& buffer() const
-    {
-        return m_buffer;
-    }
 };
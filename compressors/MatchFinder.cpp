@@ -0,0 +1,287 @@
+#include "MatchFinder.h"
+
+#include <algorithm>
+#include <bit>
+#include <numeric>
+
+namespace
+{
+    // Builds the suffix array by prefix doubling: after each pass, suffixes are sorted by their first 2k bytes
+    std::vector<int> buildSuffixArray(const std::vector<uint8_t>& data)
+    {
+        const int size = static_cast<int>(data.size());
+        if (size == 0)
+        {
+            return {};
+        }
+        std::vector<int> suffixes(size);
+        std::iota(suffixes.begin(), suffixes.end(), 0);
+        std::vector<int> ranks(data.begin(), data.end());
+        std::vector<int> newRanks(size);
+        for (int k = 1; ; k *= 2)
+        {
+            // Suffixes shorter than k sort before any that continue
+            auto key = [&](const int i)
+            {
+                return std::pair(ranks[i], i + k < size ? ranks[i + k] : -1);
+            };
+            std::ranges::sort(suffixes, [&](const int a, const int b) { return key(a) < key(b); });
+            newRanks[suffixes[0]] = 0;
+            for (int i = 1; i < size; ++i)
+            {
+                newRanks[suffixes[i]] = newRanks[suffixes[i - 1]] + (key(suffixes[i - 1]) < key(suffixes[i]) ? 1 : 0);
+            }
+            ranks.swap(newRanks);
+            if (ranks[suffixes[size - 1]] == size - 1)
+            {
+                // All distinct
+                return suffixes;
+            }
+        }
+    }
+
+    // Builds the longest common prefix of each suffix with the one before it in the suffix array, using Kasai's
+    // algorithm. We cap them at maxLength as we don't care about longer ones.
+    std::vector<uint16_t> buildLcp(
+        const std::vector<uint8_t>& data,
+        const std::vector<int>& suffixes,
+        const std::vector<int>& ranks,
+        const int maxLength)
+    {
+        const int size = static_cast<int>(data.size());
+        std::vector<uint16_t> result(size, 0);
+        int length = 0;
+        for (int position = 0; position < size; ++position)
+        {
+            const int rank = ranks[position];
+            if (rank == 0)
+            {
+                length = 0;
+                continue;
+            }
+            const int previous = suffixes[rank - 1];
+            while (position + length < size && previous + length < size
+                && data[position + length] == data[previous + length])
+            {
+                ++length;
+            }
+            result[rank] = static_cast<uint16_t>(std::min(length, maxLength));
+            if (length > 0)
+            {
+                --length;
+            }
+        }
+        return result;
+    }
+
+    // Sparse table for range minimum queries over the LCP array
+    class RangeMin
+    {
+    public:
+        explicit RangeMin(std::vector<uint16_t> values)
+        {
+            const auto size = values.size();
+            _levels.push_back(std::move(values));
+            for (std::size_t width = 2; width <= size; width *= 2)
+            {
+                const auto& previous = _levels.back();
+                std::vector<uint16_t> level(size - width + 1);
+                for (std::size_t i = 0; i < level.size(); ++i)
+                {
+                    level[i] = std::min(previous[i], previous[i + width / 2]);
+                }
+                _levels.push_back(std::move(level));
+            }
+        }
+
+        // Minimum of the 2^level values starting at index
+        [[nodiscard]]
+        int get(const int level, const int index) const
+        {
+            return _levels[level][index];
+        }
+
+        [[nodiscard]]
+        int levelCount() const
+        {
+            return static_cast<int>(_levels.size());
+        }
+
+        // Minimum of values in [first, last]
+        [[nodiscard]]
+        int query(const int first, const int last) const
+        {
+            const int level = std::bit_width(static_cast<unsigned int>(last - first + 1)) - 1;
+            return std::min(get(level, first), get(level, last - (1 << level) + 1));
+        }
+
+    private:
+        std::vector<std::vector<uint16_t>> _levels;
+    };
+
+    // Segment tree for range maximum queries over source positions, indexed by rank, where absent positions are -1
+    class RangeMax
+    {
+    public:
+        explicit RangeMax(const std::vector<int>& values):
+            _size(static_cast<int>(std::bit_ceil(std::max<std::size_t>(values.size(), 1)))),
+            _nodes(_size * 2, -1)
+        {
+            std::ranges::copy(values, _nodes.begin() + _size);
+            for (int i = _size - 1; i > 0; --i)
+            {
+                _nodes[i] = std::max(_nodes[i * 2], _nodes[i * 2 + 1]);
+            }
+        }
+
+        void remove(int index)
+        {
+            index += _size;
+            _nodes[index] = -1;
+            for (index /= 2; index > 0; index /= 2)
+            {
+                _nodes[index] = std::max(_nodes[index * 2], _nodes[index * 2 + 1]);
+            }
+        }
+
+        // Maximum of values in [first, last]
+        [[nodiscard]]
+        int query(int first, int last) const
+        {
+            int result = -1;
+            for (first += _size, last += _size + 1; first < last; first /= 2, last /= 2)
+            {
+                if (first & 1)
+                {
+                    result = std::max(result, _nodes[first++]);
+                }
+                if (last & 1)
+                {
+                    result = std::max(result, _nodes[--last]);
+                }
+            }
+            return result;
+        }
+
+    private:
+        int _size;
+        std::vector<int> _nodes;
+    };
+}
+
+MatchFinder::MatchFinder(
+    const std::vector<uint8_t>& data,
+    const int maxOffset,
+    const int minLength,
+    const int maxLength,
+    const bool allowOverlap)
+{
+    const int size = static_cast<int>(data.size());
+    const auto& suffixes = buildSuffixArray(data);
+    std::vector<int> ranks(size);
+    for (int rank = 0; rank < size; ++rank)
+    {
+        ranks[suffixes[rank]] = rank;
+    }
+    const RangeMin lcp(buildLcp(data, suffixes, ranks, maxLength));
+
+    // The suffixes sharing at least length bytes with the one at rank form a range in the suffix array,
+    // which we find by stepping outwards in decreasing powers of two
+    auto getRange = [&](const int rank, const int length)
+    {
+        int first = rank;
+        int last = rank;
+        for (int level = lcp.levelCount() - 1; level >= 0; --level)
+        {
+            const int step = 1 << level;
+            // lcp[i] relates rank i to rank i - 1
+            if (first - step >= 0 && lcp.get(level, first - step + 1) >= length)
+            {
+                first -= step;
+            }
+            if (last + step < size && lcp.get(level, last + 1) >= length)
+            {
+                last += step;
+            }
+        }
+        return std::pair(first, last);
+    };
+
+    // The nearest source for a given length is the highest source position in its range which is before the
+    // position, or (if we don't allow overlap) at least length bytes before it. We sweep backwards through the data,
+    // removing positions from a range max structure as they become unavailable, and answer each query when it
+    // becomes possible. Each answer tells us the longest length that offset provides, so the next query for that
+    // position is for one more than that, and the number of queries is the number of matches we find.
+    RangeMax sources(suffixes);
+    // Queries waiting at each time, as linked lists of positions, with the length for each position
+    std::vector<int> firstQuery(size, -1);
+    std::vector<int> nextQuery(size, -1);
+    std::vector<int> queryLength(size, minLength);
+    auto addQuery = [&](const int position, const int length)
+    {
+        const int time = allowOverlap ? position - 1 : position - length;
+        if (time < 0 || length > maxLength || position + length > size)
+        {
+            return;
+        }
+        queryLength[position] = length;
+        nextQuery[position] = firstQuery[time];
+        firstQuery[time] = position;
+    };
+    for (int position = 0; position < size; ++position)
+    {
+        addQuery(position, minLength);
+    }
+
+    // We collect the results as (position, match) and sort them afterwards
+    std::vector<std::pair<int, Match>> results;
+    for (int time = size - 1; time >= 0; --time)
+    {
+        // Only sources up to time are available
+        if (time + 1 < size)
+        {
+            sources.remove(ranks[time + 1]);
+        }
+        while (firstQuery[time] >= 0)
+        {
+            const int position = firstQuery[time];
+            firstQuery[time] = nextQuery[position];
+
+            const int rank = ranks[position];
+            const auto [first, last] = getRange(rank, queryLength[position]);
+            const int source = sources.query(first, last);
+            if (source < 0 || source < position - maxOffset)
+            {
+                // Longer lengths can only be further away
+                continue;
+            }
+            const int sourceRank = ranks[source];
+            int length = lcp.query(std::min(rank, sourceRank) + 1, std::max(rank, sourceRank));
+            if (!allowOverlap)
+            {
+                length = std::min(length, position - source);
+            }
+            results.emplace_back(position, Match{length, position - source});
+            addQuery(position, length + 1);
+        }
+    }
+
+    // Then group them by position. The sort is stable so each position's matches stay in order of length.
+    _firstMatch.resize(size + 1, 0);
+    for (const auto& result : results)
+    {
+        ++_firstMatch[result.first + 1];
+    }
+    std::partial_sum(_firstMatch.begin(), _firstMatch.end(), _firstMatch.begin());
+    _matches.resize(results.size());
+    auto nextMatch = _firstMatch;
+    for (const auto& [position, match] : results)
+    {
+        _matches[nextMatch[position]++] = match;
+    }
+}
+
+std::span<const MatchFinder::Match> MatchFinder::find(const int position) const
+{
+    return std::span(_matches).subspan(_firstMatch[position], _firstMatch[position + 1] - _firstMatch[position]);
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include <cstdint>
+#include <span>
+#include <vector>
+
+// Finds LZ matches for every position in some data, using a suffix array.
+// For each position, we find the nearest offset for every match length in a range, within a window of earlier data.
+// The results are computed up front, so positions can be queried in any order.
+class MatchFinder
+{
+public:
+    struct Match
+    {
+        int length;
+        int offset;
+    };
+
+    // maxOffset is the size of the window. If allowOverlap is true, matches may extend into the position being
+    // matched (i.e. length may exceed offset), as supported by most LZ decompressors.
+    MatchFinder(const std::vector<uint8_t>& data, int maxOffset, int minLength, int maxLength, bool allowOverlap);
+
+    // Gets the matches at position, ordered by increasing length and offset. Each match gives the nearest offset
+    // for all lengths from the previous match's length + 1 (or minLength) up to its own length.
+    [[nodiscard]]
+    std::span<const Match> find(int position) const;
+
+private:
+    std::vector<int> _firstMatch;
+    std::vector<Match> _matches;
+};
@@ -0,0 +1,432 @@
+#include "MemoryFile.h"
+
+#include <algorithm>
+#include <csetjmp>
+#include <cstdarg>
+#include <cstring>
+#include <vector>
+
+namespace
+{
+    // The MemoryFiles which exist on this thread. There are only ever a few, so we just search through them.
+    thread_local std::vector<MemoryFile*> files;
+
+    // Where exit() goes back to on this thread, while MemoryFile::run() is running some C code
+    thread_local std::jmp_buf* pExitTarget = nullptr;
+    thread_local int exitStatus = 0;
+
+#ifdef _WIN32
+    constexpr auto nullDevice = "NUL";
+#else
+    constexpr auto nullDevice = "/dev/null";
+#endif
+}
+
+MemoryFile::MemoryFile(const char* filename, const uint8_t* pData, const size_t length)
+    : _filename(filename),
+      _pData(pData),
+      _pBuffer(nullptr),
+      _capacity(0),
+      _size(length)
+{
+    files.push_back(this);
+}
+
+MemoryFile::MemoryFile(const char* filename, uint8_t* pBuffer, const size_t capacity)
+    : _filename(filename),
+      _pData(pBuffer),
+      _pBuffer(pBuffer),
+      _capacity(capacity)
+{
+    files.push_back(this);
+}
+
+MemoryFile::~MemoryFile()
+{
+    close();
+    std::erase(files, this);
+}
+
+bool MemoryFile::open(const char* mode)
+{
+    if (_isOpen)
+    {
+        return false;
+    }
+    switch (mode[0])
+    {
+    case 'r':
+        _position = 0;
+        break;
+    case 'w':
+        if (_pBuffer == nullptr)
+        {
+            return false;
+        }
+        _size = 0;
+        _position = 0;
+        _isTruncated = false;
+        break;
+    case 'a':
+        if (_pBuffer == nullptr)
+        {
+            return false;
+        }
+        _position = _size;
+        break;
+    default:
+        return false;
+    }
+    // The C code gets a real FILE*, so it's safe with anything it passes that to
+#pragma warning(suppress: 4996) // It's the null device
+    _pHandle = fopen(nullDevice, "w+b");
+    if (_pHandle == nullptr)
+    {
+        return false;
+    }
+    _isOpen = true;
+    _isEof = false;
+    _isError = false;
+    return true;
+}
+
+void MemoryFile::close()
+{
+    if (_isOpen)
+    {
+        fclose(_pHandle);
+        _pHandle = nullptr;
+        _isOpen = false;
+    }
+}
+
+size_t MemoryFile::read(void* buffer, const size_t length)
+{
+    const auto count = std::min(length, _size - std::min(_position, _size));
+    if (count > 0)
+    {
+        std::copy_n(_pData + _position, count, static_cast<uint8_t*>(buffer));
+        _position += count;
+    }
+    if (count < length)
+    {
+        _isEof = true;
+    }
+    return count;
+}
+
+size_t MemoryFile::write(const void* buffer, const size_t length)
+{
+    if (_pBuffer == nullptr)
+    {
+        _isError = true;
+        return 0;
+    }
+    // If it seeked past the end, the gap is zeroes
+    if (_position > _size)
+    {
+        std::fill(_pBuffer + _size, _pBuffer + std::min(_position, _capacity), uint8_t{0});
+    }
+    const auto count = std::min(length, _capacity - std::min(_position, _capacity));
+    if (count > 0)
+    {
+        std::copy_n(static_cast<const uint8_t*>(buffer), count, _pBuffer + _position);
+        _position += count;
+        _size = std::max(_size, _position);
+    }
+    if (count < length)
+    {
+        _isTruncated = true;
+        _isError = true;
+    }
+    return count;
+}
+
+bool MemoryFile::seek(const long offset, const int origin)
+{
+    long base;
+    switch (origin)
+    {
+    case SEEK_SET:
+        base = 0;
+        break;
+    case SEEK_CUR:
+        base = static_cast<long>(_position);
+        break;
+    case SEEK_END:
+        base = static_cast<long>(_size);
+        break;
+    default:
+        return false;
+    }
+    if (base + offset < 0)
+    {
+        return false;
+    }
+    _position = static_cast<size_t>(base + offset);
+    _isEof = false;
+    return true;
+}
+
+bool MemoryFile::unread(const uint8_t b)
+{
+    if (_position == 0 || _position > _size || _pData[_position - 1] != b)
+    {
+        return false;
+    }
+    --_position;
+    _isEof = false;
+    return true;
+}
+
+MemoryFile* MemoryFile::find(const char* filename)
+{
+    const auto it = std::ranges::find_if(files, [filename](const MemoryFile* pFile)
+    {
+        return pFile->_filename == filename;
+    });
+    return it == files.end() ? nullptr : *it;
+}
+
+MemoryFile* MemoryFile::find(FILE* f)
+{
+    const auto it = std::ranges::find_if(files, [f](const MemoryFile* pFile)
+    {
+        return pFile->_isOpen && pFile->_pHandle == f;
+    });
+    return it == files.end() ? nullptr : *it;
+}
+
+int MemoryFile::run(const std::function<int()>& f)
+{
+    std::jmp_buf target;
+    auto* pPreviousTarget = pExitTarget;
+    pExitTarget = &target;
+    volatile int result;
+    if (setjmp(target) == 0)
+    {
+        result = f();
+    }
+    else
+    {
+        // It called exit()
+        result = exitStatus;
+    }
+    pExitTarget = pPreviousTarget;
+    return result;
+}
+
+extern "C" FILE* memoryFileOpen(const char* filename, const char* mode)
+{
+    if (auto* pFile = MemoryFile::find(filename); pFile != nullptr)
+    {
+        return pFile->open(mode) ? pFile->handle() : nullptr;
+    }
+#pragma warning(suppress: 4996) // The C code asked for fopen()
+    return fopen(filename, mode);
+}
+
+extern "C" int memoryFileClose(FILE* f)
+{
+    if (auto* pFile = MemoryFile::find(f); pFile != nullptr)
+    {
+        pFile->close();
+        return 0;
+    }
+    return fclose(f);
+}
+
+extern "C" size_t memoryFileRead(void* buffer, const size_t size, const size_t count, FILE* f)
+{
+    if (auto* pFile = MemoryFile::find(f); pFile != nullptr)
+    {
+        return size == 0 ? 0 : pFile->read(buffer, size * count) / size;
+    }
+    return fread(buffer, size, count, f);
+}
+
+extern "C" size_t memoryFileWrite(const void* buffer, const size_t size, const size_t count, FILE* f)
+{
+    if (auto* pFile = MemoryFile::find(f); pFile != nullptr)
+    {
+        return size == 0 ? 0 : pFile->write(buffer, size * count) / size;
+    }
+    return fwrite(buffer, size, count, f);
+}
+
+extern "C" int memoryFileGetc(FILE* f)
+{
+    if (auto* pFile = MemoryFile::find(f); pFile != nullptr)
+    {
+        uint8_t c;
+        return pFile->read(&c, 1) == 1 ? c : EOF;
+    }
+    return fgetc(f);
+}
+
+extern "C" int memoryFilePutc(const int c, FILE* f)
+{
+    if (auto* pFile = MemoryFile::find(f); pFile != nullptr)
+    {
+        const auto b = static_cast<uint8_t>(c);
+        return pFile->write(&b, 1) == 1 ? b : EOF;
+    }
+    return fputc(c, f);
+}
+
+extern "C" int memoryFilePuts(const char* s, FILE* f)
+{
+    if (auto* pFile = MemoryFile::find(f); pFile != nullptr)
+    {
+        const auto length = strlen(s);
+        return pFile->write(s, length) == length ? 0 : EOF;
+    }
+    return fputs(s, f);
+}
+
+extern "C" int memoryFilePrintf(FILE* f, const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    const int result = memoryFileVprintf(f, format, args);
+    va_end(args);
+    return result;
+}
+
+extern "C" int memoryFileVprintf(FILE* f, const char* format, va_list args)
+{
+    if (auto* pFile = MemoryFile::find(f); pFile != nullptr)
+    {
+        // Format it into a buffer first, to find out how big it is
+        va_list argsCopy;
+        va_copy(argsCopy, args);
+        int result = vsnprintf(nullptr, 0, format, argsCopy);
+        va_end(argsCopy);
+        if (result > 0)
+        {
+            std::vector<char> buffer(static_cast<size_t>(result) + 1);
+            vsnprintf(buffer.data(), buffer.size(), format, args);
+            if (pFile->write(buffer.data(), static_cast<size_t>(result)) != static_cast<size_t>(result))
+            {
+                result = -1;
+            }
+        }
+        return result;
+    }
+    return vfprintf(f, format, args);
+}
+
+extern "C" int memoryFileSeek(FILE* f, const long offset, const int origin)
+{
+    if (auto* pFile = MemoryFile::find(f); pFile != nullptr)
+    {
+        return pFile->seek(offset, origin) ? 0 : -1;
+    }
+    return fseek(f, offset, origin);
+}
+
+extern "C" long memoryFileTell(FILE* f)
+{
+    if (auto* pFile = MemoryFile::find(f); pFile != nullptr)
+    {
+        return pFile->tell();
+    }
+    return ftell(f);
+}
+
+extern "C" void memoryFileRewind(FILE* f)
+{
+    if (auto* pFile = MemoryFile::find(f); pFile != nullptr)
+    {
+        pFile->seek(0, SEEK_SET);
+        return;
+    }
+    rewind(f);
+}
+
+extern "C" int memoryFileEof(FILE* f)
+{
+    if (auto* pFile = MemoryFile::find(f); pFile != nullptr)
+    {
+        return pFile->isEof() ? 1 : 0;
+    }
+    return feof(f);
+}
+
+extern "C" int memoryFileError(FILE* f)
+{
+    if (auto* pFile = MemoryFile::find(f); pFile != nullptr)
+    {
+        return pFile->isError() ? 1 : 0;
+    }
+    return ferror(f);
+}
+
+extern "C" int memoryFileFlush(FILE* f)
+{
+    if (f != nullptr && MemoryFile::find(f) != nullptr)
+    {
+        return 0;
+    }
+    return fflush(f);
+}
+
+extern "C" char* memoryFileGets(char* s, const int count, FILE* f)
+{
+    if (auto* pFile = MemoryFile::find(f); pFile != nullptr)
+    {
+        if (count <= 0)
+        {
+            return nullptr;
+        }
+        // Read up to and including a newline, leaving space for the terminator
+        int length = 0;
+        uint8_t c;
+        while (length < count - 1 && pFile->read(&c, 1) == 1)
+        {
+            s[length++] = static_cast<char>(c);
+            if (c == '\n')
+            {
+                break;
+            }
+        }
+        if (length == 0)
+        {
+            return nullptr;
+        }
+        s[length] = '\0';
+        return s;
+    }
+    return fgets(s, count, f);
+}
+
+extern "C" int memoryFileUngetc(const int c, FILE* f)
+{
+    if (auto* pFile = MemoryFile::find(f); pFile != nullptr)
+    {
+        // We can only put back what was there, as our input is read-only
+        return c != EOF && pFile->unread(static_cast<uint8_t>(c)) ? static_cast<uint8_t>(c) : EOF;
+    }
+    return ungetc(c, f);
+}
+
+extern "C" void memoryFileClearerr(FILE* f)
+{
+    if (auto* pFile = MemoryFile::find(f); pFile != nullptr)
+    {
+        pFile->clearErrors();
+        return;
+    }
+    clearerr(f);
+}
+
+extern "C" void memoryFileExit(const int status)
+{
+    if (pExitTarget == nullptr)
+    {
+        // Not called via MemoryFile::run()
+        exit(status);
+    }
+    exitStatus = status;
+    std::longjmp(*pExitTarget, 1);
+}
@@ -0,0 +1,161 @@
+#pragma once
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Lets third party C code which only works on files read and write memory instead, without changing its source.
+// A plugin makes a MemoryFile with a name, then passes that name to the C code as a filename; when the code opens that
+// name on the same thread, it gets the memory instead of a file. Any other name, or stdin/stdout/stderr, still goes to
+// the real file functions.
+//
+// The C source is compiled with this header force-included (/FI), which redirects its stdio calls to the functions
+// below. It only does that for C, so C++ code including this header to make MemoryFiles keeps the real functions.
+// The handle the C code gets is a real FILE* on the null device, so any stdio call we don't redirect (setvbuf(),
+// fileno() and so on) is still safe, it just doesn't see our data. exit() is redirected too, so that the plugin can
+// stop the C code from ending the host process; see MemoryFile::run().
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+FILE* memoryFileOpen(const char* filename, const char* mode);
+int memoryFileClose(FILE* f);
+size_t memoryFileRead(void* buffer, size_t size, size_t count, FILE* f);
+size_t memoryFileWrite(const void* buffer, size_t size, size_t count, FILE* f);
+int memoryFileGetc(FILE* f);
+int memoryFilePutc(int c, FILE* f);
+int memoryFilePuts(const char* s, FILE* f);
+int memoryFilePrintf(FILE* f, const char* format, ...);
+int memoryFileSeek(FILE* f, long offset, int origin);
+long memoryFileTell(FILE* f);
+void memoryFileRewind(FILE* f);
+int memoryFileEof(FILE* f);
+int memoryFileError(FILE* f);
+int memoryFileFlush(FILE* f);
+char* memoryFileGets(char* s, int count, FILE* f);
+int memoryFileUngetc(int c, FILE* f);
+int memoryFileVprintf(FILE* f, const char* format, va_list args);
+void memoryFileClearerr(FILE* f);
+#ifdef _MSC_VER
+__declspec(noreturn)
+#endif
+void memoryFileExit(int status);
+
+#ifdef __cplusplus
+}
+
+#include <cstdint>
+#include <functional>
+#include <string>
+
+class MemoryFile
+{
+public:
+    // Opening filename on this thread reads length bytes from pData. It can't be written.
+    MemoryFile(const char* filename, const uint8_t* pData, size_t length);
+
+    // Opening filename on this thread writes to pBuffer, up to capacity bytes. Anything past that is dropped, and
+    // isTruncated() says so.
+    MemoryFile(const char* filename, uint8_t* pBuffer, size_t capacity);
+
+    ~MemoryFile();
+
+    MemoryFile(const MemoryFile&) = delete;
+    MemoryFile& operator=(const MemoryFile&) = delete;
+
+    // How many bytes the file holds
+    [[nodiscard]] size_t size() const
+    {
+        return _size;
+    }
+
+    // Whether anything was written past the capacity
+    [[nodiscard]] bool isTruncated() const
+    {
+        return _isTruncated;
+    }
+
+    // These work like their stdio equivalents
+    bool open(const char* mode);
+    void close();
+    size_t read(void* buffer, size_t length);
+    size_t write(const void* buffer, size_t length);
+    bool seek(long offset, int origin);
+    [[nodiscard]] long tell() const
+    {
+        return static_cast<long>(_position);
+    }
+    [[nodiscard]] bool isEof() const
+    {
+        return _isEof;
+    }
+    [[nodiscard]] bool isError() const
+    {
+        return _isError;
+    }
+    void clearErrors()
+    {
+        _isEof = false;
+        _isError = false;
+    }
+
+    // Puts back a byte read by the last read, as ungetc() does
+    bool unread(uint8_t b);
+
+    // The FILE* the C code sees while the file is open
+    [[nodiscard]] FILE* handle() const
+    {
+        return _pHandle;
+    }
+
+    // Gets the MemoryFile on this thread with the given name, or the open one with the given handle, or nullptr
+    static MemoryFile* find(const char* filename);
+    static MemoryFile* find(FILE* f);
+
+    // Runs f, which calls into the C code, and returns its result. If the C code calls exit(), we come back here
+    // instead of ending the process, and return the status it gave. Anything the C code had allocated is leaked.
+    static int run(const std::function<int()>& f);
+
+private:
+    std::string _filename;
+    FILE* _pHandle = nullptr;
+    const uint8_t* _pData;
+    uint8_t* _pBuffer;
+    size_t _capacity;
+    size_t _size = 0;
+    size_t _position = 0;
+    bool _isOpen = false;
+    bool _isEof = false;
+    bool _isError = false;
+    bool _isTruncated = false;
+};
+
+#else
+
+#undef getc
+#undef putc
+#define fopen memoryFileOpen
+#define fclose memoryFileClose
+#define fread memoryFileRead
+#define fwrite memoryFileWrite
+#define fgetc memoryFileGetc
+#define getc memoryFileGetc
+#define fputc memoryFilePutc
+#define putc memoryFilePutc
+#define fputs memoryFilePuts
+#define fprintf memoryFilePrintf
+#define fseek memoryFileSeek
+#define ftell memoryFileTell
+#define rewind memoryFileRewind
+#define feof memoryFileEof
+#define ferror memoryFileError
+#define fflush memoryFileFlush
+#define fgets memoryFileGets
+#define ungetc memoryFileUngetc
+#define vfprintf memoryFileVprintf
+#define clearerr memoryFileClearerr
+#define exit memoryFileExit
+
+#endif
@@ -0,0 +1,194 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <limits>
+#include <type_traits>
+#include <vector>
+
+// Implements the bookkeeping for an optimal parse, where we work backwards through the data finding the cheapest
+// sequence of tokens from each position to the end. Format supplies:
+// - Token, an enum of the token types, where the default value means "none"
+// - Cost, the type of the costs we are minimising
+// The state is stored as one array per field, as the inner loops of a parse only look at the costs.
+template <typename Format>
+class OptimalParser
+{
+public:
+    using Token = typename Format::Token;
+    using Cost = typename Format::Cost;
+    static_assert(std::is_enum_v<Token>);
+    static_assert(std::is_integral_v<Cost>);
+
+    // The cost to the end from positions we have found no way to the end from. Costs are never added to this, as
+    // that would overflow.
+    static constexpr Cost unreachable = std::numeric_limits<Cost>::max();
+
+    OptimalParser() = default;
+
+    explicit OptimalParser(const std::size_t size)
+    {
+        reset(size);
+    }
+
+    // Prepares for a parse of size bytes, reusing the memory from any previous one
+    void reset(const std::size_t size)
+    {
+        _costToEnd.assign(size + 1, unreachable);
+        _tokens.assign(size, Token{});
+        _lengths.assign(size, 0);
+        _values.assign(size, 0);
+        // Getting to the end from the end is free
+        _costToEnd[size] = 0;
+    }
+
+    [[nodiscard]]
+    int size() const
+    {
+        return static_cast<int>(_tokens.size());
+    }
+
+    // The cheapest cost found so far from position to the end
+    [[nodiscard]]
+    Cost costToEnd(const int position) const
+    {
+        return _costToEnd[position];
+    }
+
+    // Considers a token at position covering length bytes, where costToEnd includes the cost of the rest of the data
+    // after it. We keep it only if it is cheaper than what we have already, so the first of equal cost options wins.
+    // value is for the format to use when writing the token.
+    bool offer(const int position, const Token token, const int length, const int value, const Cost costToEnd)
+    {
+        if (costToEnd >= _costToEnd[position])
+        {
+            return false;
+        }
+        _costToEnd[position] = costToEnd;
+        _tokens[position] = token;
+        _lengths[position] = length;
+        _values[position] = value;
+        return true;
+    }
+
+    // Considers a token at position for every length from minLength to maxLength, costing fixedCost + perByteCost
+    // per byte. Shorter lengths win for equal costs.
+    void offerLengths(
+        const int position,
+        const Token token,
+        const int minLength,
+        const int maxLength,
+        const Cost fixedCost,
+        const Cost perByteCost,
+        const int value = 0)
+    {
+        const auto lastLength = std::min(maxLength, size() - position);
+        for (int length = minLength; length <= lastLength; ++length)
+        {
+            if (_costToEnd[position + length] == unreachable)
+            {
+                continue;
+            }
+            offer(position, token, length, value, fixedCost + perByteCost * length + _costToEnd[position + length]);
+        }
+    }
+
+    // Walks through the chosen tokens from the start. f is called with (position, token, length, value). If it
+    // returns a bool, returning false stops the walk, e.g. when the output no longer fits.
+    template <typename F>
+    void trace(F&& f) const
+    {
+        for (int position = 0; position < size(); position += _lengths[position])
+        {
+            if constexpr (std::is_same_v<std::invoke_result_t<F&, int, Token, int, int>, bool>)
+            {
+                if (!f(position, _tokens[position], _lengths[position], _values[position]))
+                {
+                    return;
+                }
+            }
+            else
+            {
+                f(position, _tokens[position], _lengths[position], _values[position]);
+            }
+        }
+    }
+
+    // Finds the cheapest run for a token whose cost is linear in its length, such as a raw run, as we work backwards
+    // through the data. This gives the same result as offerLengths() in amortised O(1) time per position.
+    // A run of k bytes at position p costs fixed + k * perByte + costToEnd(p + k), so we want the smallest
+    // value of (costToEnd(j) + j * perByte) for j in the range of run ends reachable from p. That range
+    // slides back by one each time p does, so we keep a deque of candidate run ends, ordered by position, where each
+    // one is cheaper than every nearer one. The cheapest is then always at the back, and each position is added and
+    // removed at most once. For equal costs we keep the nearest end, i.e. the shortest run.
+    class RunFinder
+    {
+    public:
+        RunFinder(
+            const Token token,
+            const int minLength,
+            const int maxLength,
+            const Cost fixedCost,
+            const Cost perByteCost):
+            _token(token),
+            _fixedCost(fixedCost),
+            _perByteCost(perByteCost),
+            _minLength(std::max(minLength, 1)),
+            _maxLength(maxLength)
+        {
+        }
+
+        // This must be called for each position in turn, from the end of the data backwards
+        void tryAt(const int position, OptimalParser& parser)
+        {
+            // The shortest run from here is a new candidate, if it doesn't go past the end and the end can reach the
+            // end of the data
+            if (const auto end = position + _minLength; end <= parser.size() && parser.costToEnd(end) != unreachable)
+            {
+                const auto cost = costOf(end, parser);
+                while (!_candidates.empty() && costOf(_candidates.front(), parser) >= cost)
+                {
+                    _candidates.pop_front();
+                }
+                _candidates.push_front(end);
+            }
+            // The longest run from here may no longer reach the furthest candidates
+            while (!_candidates.empty() && _candidates.back() > position + _maxLength)
+            {
+                _candidates.pop_back();
+            }
+            if (_candidates.empty())
+            {
+                return;
+            }
+            const auto length = _candidates.back() - position;
+            parser.offer(
+                position,
+                _token,
+                length,
+                0,
+                _fixedCost + _perByteCost * length + parser.costToEnd(_candidates.back()));
+        }
+
+    private:
+        [[nodiscard]]
+        Cost costOf(const int end, const OptimalParser& parser) const
+        {
+            return parser.costToEnd(end) + _perByteCost * end;
+        }
+
+        Token _token;
+        Cost _fixedCost;
+        Cost _perByteCost;
+        int _minLength;
+        int _maxLength;
+        // Run end positions
+        std::deque<int> _candidates;
+    };
+
+private:
+    std::vector<Cost> _costToEnd;
+    std::vector<Token> _tokens;
+    std::vector<int> _lengths;
+    std::vector<int> _values;
+};
@@ -0,0 +1,79 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "utils.h"
+
+// Writes compressed data straight into the caller's destination buffer, so we don't need to build it elsewhere and
+// copy it. Once the data no longer fits, further writes are dropped and isFull() becomes true, so encoders can stop
+// early. We keep counting the size either way, so offsets handed out stay consistent.
+class OutputSink
+{
+public:
+    OutputSink(uint8_t* pDestination, const std::size_t capacity):
+        _pDestination(pDestination),
+        _capacity(capacity)
+    {
+    }
+
+    void addByte(const uint8_t b)
+    {
+        if (_size < _capacity)
+        {
+            _pDestination[_size] = b;
+        }
+        else
+        {
+            _full = true;
+        }
+        ++_size;
+    }
+
+    void addBytes(const std::vector<uint8_t>& source, const std::size_t offset, const std::size_t count)
+    {
+        if (_size < _capacity)
+        {
+            std::copy_n(source.begin() + offset, std::min(count, _capacity - _size), _pDestination + _size);
+        }
+        if (_size + count > _capacity)
+        {
+            _full = true;
+        }
+        _size += count;
+    }
+
+    // Replaces a byte already added, for formats which fill in bytes after later ones are written
+    void setByte(const std::size_t offset, const uint8_t b) const
+    {
+        if (offset < _capacity)
+        {
+            _pDestination[offset] = b;
+        }
+    }
+
+    [[nodiscard]]
+    std::size_t size() const
+    {
+        return _size;
+    }
+
+    [[nodiscard]]
+    bool isFull() const
+    {
+        return _full;
+    }
+
+    // The return value for the compressor
+    [[nodiscard]]
+    int32_t result() const
+    {
+        return _full ? ReturnValues::BufferTooSmall : static_cast<int32_t>(_size);
+    }
+
+private:
+    uint8_t* _pDestination;
+    std::size_t _capacity;
+    std::size_t _size = 0;
+    bool _full = false;
+};
@@ -0,0 +1,2048 @@
+#include "Z80Cycles.h"
+
+#include <functional>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace
+{
+    // ld hl,data; ld de,$4000; call decompressor
+    constexpr int64_t callCycles = 10 + 10 + 17;
+    // The caller's ret at the end of the benchmark
+    constexpr int64_t returnCycles = 10;
+
+    // Reads the compressed data, throwing if it runs out
+    class Reader
+    {
+    public:
+        Reader(const uint8_t* pData, const uint32_t length):
+            _pData(pData),
+            _length(length)
+        {
+        }
+
+        uint8_t next()
+        {
+            if (_position >= _length)
+            {
+                throw std::runtime_error("Unexpected end of data");
+            }
+            return _pData[_position++];
+        }
+
+        // Reads a little-endian word
+        uint16_t nextWord()
+        {
+            const auto low = next();
+            return static_cast<uint16_t>(low | (next() << 8));
+        }
+
+        // For when the decompressor reads past the end of the data, but doesn't use what it gets
+        uint8_t nextOrZero()
+        {
+            return _position < _length ? _pData[_position++] : 0;
+        }
+
+        // For formats with several parts, gets a byte at the given offset
+        [[nodiscard]]
+        uint8_t at(const uint32_t offset) const
+        {
+            if (offset >= _length)
+            {
+                throw std::runtime_error("Offset out of range");
+            }
+            return _pData[offset];
+        }
+
+        [[nodiscard]]
+        uint16_t wordAt(const uint32_t offset) const
+        {
+            return static_cast<uint16_t>(at(offset) | (at(offset + 1) << 8));
+        }
+
+        [[nodiscard]]
+        uint32_t position() const
+        {
+            return _position;
+        }
+
+        [[nodiscard]]
+        uint32_t remaining() const
+        {
+            return _length - _position;
+        }
+
+    private:
+        const uint8_t* _pData;
+        uint32_t _length;
+        uint32_t _position = 0;
+    };
+
+    // Reads bits the way many decompressors do: a register holds the current byte shifted left with a 1 bit following
+    // the data bits, so when it becomes 0 after a shift, it is time to read the next byte.
+    class SentinelBitReader
+    {
+    public:
+        explicit SentinelBitReader(Reader& reader):
+            _reader(reader)
+        {
+        }
+
+        // Gets the next bit, and whether we had to read a new byte for it. If mayOverrun is true, we allow reading past
+        // the end of the data.
+        int next(bool& refilled, const bool mayOverrun = false)
+        {
+            int bit = _a >> 7;
+            _a = static_cast<uint8_t>(_a << 1);
+            refilled = _a == 0;
+            if (refilled)
+            {
+                // rla with carry = 1
+                const auto b = mayOverrun ? _reader.nextOrZero() : _reader.next();
+                bit = b >> 7;
+                _a = static_cast<uint8_t>((b << 1) | 1);
+            }
+            return bit;
+        }
+
+    private:
+        Reader& _reader;
+        uint8_t _a = 0x80;
+    };
+
+    // Counts how many times the low byte of the VRAM address wraps while writing some bytes, for decompressors which
+    // need to handle that. We assume the destination is 256-aligned.
+    int64_t countWraps(const uint32_t outputPosition, const uint32_t count)
+    {
+        return (outputPosition + count) / 256 - outputPosition / 256;
+    }
+
+    // Copies count bytes within VRAM, as _ldir_vram_to_vram does in the Micro Machines and LZ4 decompressors
+    int64_t ldirVramToVram(const uint32_t count)
+    {
+        // call _ldir_vram_to_vram; res 6,h; ld a,b; or a; jp z,_below256
+        int64_t cycles = 17 + 8 + 4 + 4 + 10;
+        // Each byte: out (c),l; out (c),h; in a,($be); out (c),e; out (c),d; out ($be),a; inc hl; inc de; djnz -
+        constexpr int perByte = 95;
+        if (count > 0xff)
+        {
+            // push bc; ld b,0; call +; 256 bytes; ret; pop bc; djnz - for each 256
+            cycles += (count >> 8) * (11 + 7 + 17 + 7 + 256 * perByte - 5 + 10 + 10 + 13) - 5;
+        }
+        // ld b,c; ld c,$bf; the bytes (where 0 means 256); ret
+        const auto low = count & 0xff;
+        return cycles + 4 + 7 + (low == 0 ? 256 : low) * perByte - 5 + 10;
+    }
+
+    int64_t aleste(Reader& data)
+    {
+        int64_t cycles = 0;
+        uint32_t outputPosition = 0;
+        for (;;)
+        {
+            // ld (aleste_decompress_pointer),de; ld a,(hl); and a; jp m,_lz
+            cycles += 20 + 7 + 4 + 10;
+            const auto token = data.next();
+            if (token == 0)
+            {
+                // ret z
+                return cycles + 11;
+            }
+            uint32_t count;
+            if (token & 0x80)
+            {
+                count = (token & 0x7f) + 3u;
+                data.next();
+                // Setup, then ld a,(hl); out ($be),a; ld (de),a; inc l; inc e; jp nz,+; djnz - per byte, and inc c
+                // when e wraps
+                cycles += 129 + count * 56 - 5 + countWraps(outputPosition, count) * 4;
+                // ld d,c; ld (aleste_decompress_pointer),de; pop hl
+                cycles += 4 + 20 + 10;
+            }
+            else
+            {
+                count = token;
+                for (auto i = 0u; i < count; ++i)
+                {
+                    data.next();
+                }
+                // ret z not taken, setup, then ld a,(hl); out ($be),a; inc hl; ld (de),a; inc e; jp nz,+; djnz - per
+                // byte, and inc c when e wraps
+                cycles += 5 + 72 + count * 58 - 5 + countWraps(outputPosition, count) * 4;
+                // ld d,c; ld (aleste_decompress_pointer),de; jp aleste_decompress
+                cycles += 4 + 20 + 10;
+            }
+            outputPosition += count;
+        }
+    }
+
+    int64_t zx7(Reader& data)
+    {
+        SentinelBitReader bits(data);
+        // add a,a; call z,_nextFlagsByte; and the call and its body if taken
+        auto readBit = [&](int64_t& cycles, const bool mayOverrun = false)
+        {
+            bool refilled;
+            const auto bit = bits.next(refilled, mayOverrun);
+            cycles += 4 + (refilled ? 17 + 7 + 6 + 4 + 10 : 10);
+            return bit;
+        };
+
+        // Set VRAM address; ld a,1<<7; then the first byte is always a literal: outi; inc de
+        int64_t cycles = 7 + 12 + 12 + 4 + 7 + 16 + 6;
+        data.next();
+        for (;;)
+        {
+            if (readBit(cycles) == 0)
+            {
+                // Literal: jr nc,- taken; outi; inc de
+                data.next();
+                cycles += 12 + 16 + 6;
+                continue;
+            }
+            // jr nc,- not taken; push de; ld b,1; ld d,0
+            cycles += 7 + 11 + 7 + 7;
+
+            // Count the zero bits for the length: inc d, read, jr nc,- each time
+            int lengthBits = 0;
+            for (;;)
+            {
+                cycles += 4;
+                if (readBit(cycles))
+                {
+                    // jr nc not taken; jp +
+                    cycles += 7 + 10;
+                    break;
+                }
+                cycles += 12;
+                ++lengthBits;
+            }
+            // Then read that many bits: dec d; jr nz,- taken; read; rl b; jp c,_done. The end marker has more bits than
+            // fit in b, so we stop when the first bit falls out, which may be past the end of the data.
+            uint32_t length = 1;
+            for (int i = 0; i < lengthBits; ++i)
+            {
+                cycles += 4 + 12;
+                length = (length << 1) | readBit(cycles, lengthBits >= 8);
+                cycles += 8 + 10;
+                if (length > 0xff)
+                {
+                    // _done: pop hl; ret
+                    return cycles + 10 + 10;
+                }
+            }
+            // dec d; jr nz not taken; inc b
+            cycles += 4 + 7 + 4;
+            ++length;
+
+            // ld e,(hl); inc hl; sll e; jr nc,+
+            const auto offset = data.next();
+            cycles += 7 + 6 + 8;
+            if (offset & 0x80)
+            {
+                // Not taken, then four more bits: three with rl d, and one with ccf; jr c,+; inc d if not taken
+                cycles += 7;
+                for (int i = 0; i < 3; ++i)
+                {
+                    readBit(cycles);
+                    cycles += 8;
+                }
+                cycles += readBit(cycles) ? 4 + 7 + 4 : 4 + 12;
+            }
+            else
+            {
+                cycles += 12;
+            }
+            // rr e; ex (sp),hl; push hl; sbc hl,de; pop de; push af; res 6,h; inc c
+            cycles += 8 + 19 + 11 + 15 + 10 + 11 + 8 + 4;
+            // Per byte: out (c),l; out (c),h; inc hl; in a,($be); out (c),e; out (c),d; inc de; out ($be),a; djnz -
+            cycles += length * 95 - 5;
+            // pop af; dec c; pop hl; jp nc,--
+            cycles += 10 + 4 + 10 + 10;
+        }
+    }
+
+    int64_t sonic1(Reader& data)
+    {
+        // Read the header and set up the pointers
+        int64_t cycles = 293;
+        uint32_t duplicateRowsOffset = data.wordAt(2);
+        const auto rowCount = data.wordAt(6);
+        for (uint32_t row = 0; row < rowCount; ++row)
+        {
+            // Get the bit for this row in the unique rows list, and jr nz,_duplicateRow
+            cycles += 193;
+            if ((data.at(8 + row / 8) & (1 << (row % 8))) == 0)
+            {
+                // Not taken, then copy the next 4 bytes of art
+                cycles += 7 + 4 + 4 * 24 + 4 + 12;
+            }
+            else
+            {
+                // Taken, then read the index, which is two bytes if it is $f0 or more, and copy 4 bytes from it
+                cycles += 12 + 4 + 7 + 6 + 4 + 7 + 7;
+                if (data.at(duplicateRowsOffset++) < 0xf0)
+                {
+                    cycles += 12;
+                }
+                else
+                {
+                    ++duplicateRowsOffset;
+                    cycles += 7 + 7 + 4 + 4 + 7 + 6 + 4;
+                }
+                cycles += 4 + 11 + 11 + 20 + 11 + 4 * 24;
+            }
+            // dec bc; ld a,b; or c; jr nz,_processRow
+            cycles += 6 + 4 + 4 + (row == rowCount - 1u ? 7 : 12);
+        }
+        // ret
+        return cycles + 10;
+    }
+
+    int64_t sonic2(Reader& data)
+    {
+        // Read the header and set up the pointers
+        int64_t cycles = 202;
+        const auto tileCount = data.wordAt(2);
+        uint32_t bitStreamOffset = data.wordAt(4);
+        uint32_t dataOffset = 6;
+        for (uint32_t tile = 0; tile < tileCount; ++tile)
+        {
+            // Get the tile type from the bitstream, two bits at a time
+            const auto counter = tile % 4;
+            if (counter == 0 && tile > 0)
+            {
+                // Move to the next bitstream byte
+                ++bitStreamOffset;
+                cycles += 13 + 7 + 7 + 16 + 6 + 16 + 4 + 13;
+            }
+            else
+            {
+                cycles += 13 + 7 + 12;
+            }
+            // Read the byte, rrca twice per bit pair to skip, increment the counter and mask
+            cycles += 27 + counter * 32 + 14 + 28;
+            const auto type = (data.at(bitStreamOffset) >> (counter * 2)) & 3;
+            switch (type)
+            {
+            case 0:
+                // jr z,_emitZeroBuffer; 32 * out ($be),a; jp _tileDone
+                cycles += 12 + 32 * 11 + 10;
+                break;
+            case 1:
+                // Copy 32 bytes from the data
+                dataOffset += 32;
+                cycles += 7 + 4 + 12 + 16 + 7 + 32 * 37 - 5 + 16 + 10;
+                break;
+            case 2:
+            case 3:
+            {
+                // Read 32 bits of flags, then a byte for each 1 bit
+                uint32_t flags = 0;
+                for (int i = 0; i < 4; ++i)
+                {
+                    flags |= data.at(dataOffset++) << (i * 8);
+                }
+                cycles += 118;
+                for (int i = 0; i < 32; ++i)
+                {
+                    if (flags & (1u << i))
+                    {
+                        ++dataOffset;
+                        cycles += 123;
+                    }
+                    else
+                    {
+                        cycles += 117;
+                    }
+                }
+                // The last jr nz not taken; ld (Sonic2TileLoader_DataPointer),hl; pop af; dec a
+                cycles += -5 + 16 + 10 + 4;
+                // call nz,_xor for type 3
+                cycles += type == 3 ? 17 + 14 + 7 + 7 * 261 - 5 + 10 : 10;
+                // Emit the 32 bytes
+                cycles += 10 + 7 + 32 * 37 - 5;
+                break;
+            }
+            default:
+                break;
+            }
+            // Count down the tiles: ret z if done, else jp ➿
+            cycles += 16 + 6 + 16 + 4 + 4 + (tile == tileCount - 1u ? 11 : 5 + 10);
+        }
+        // Check the data was all there
+        if (dataOffset > 0)
+        {
+            static_cast<void>(data.at(dataOffset - 1));
+        }
+        return cycles;
+    }
+
+    // This is for the smaller decompressor, not the fast one
+    int64_t phantasyStarGaiden(Reader& data)
+    {
+        // It's called with ix = data, which takes 4 more cycles to set up than hl
+        int64_t cycles = 4;
+        // Cache the VRAM address and read the tile count
+        cycles += 16 + 19 + 10 + 19 + 10;
+        const uint32_t tileCount = data.nextWord();
+
+        // Emits 8 bytes, taking them from the data where mask has a 0 bit
+        auto output = [&](uint8_t mask, const int cyclesPerMaskedByte, const int cyclesPerDataByte)
+        {
+            // push bc; ld b,8; then each byte; and the last djnz not taken; pop bc
+            cycles += 11 + 7 - 5 + 10;
+            for (int i = 0; i < 8; ++i, mask <<= 1)
+            {
+                if (mask & 0x80)
+                {
+                    cycles += cyclesPerMaskedByte;
+                }
+                else
+                {
+                    data.next();
+                    cycles += cyclesPerDataByte;
+                }
+            }
+        };
+        // ld a,l; rlc h; jr c,+; (ld a,(ix+0); inc ix); ld (de),a; inc de; djnz -; and jr _BitplaneDone after
+        auto outputCommonValue = [&](const uint8_t mask)
+        {
+            output(mask, 50, 74);
+            cycles += 12;
+        };
+        // ld a,(iy+0); inc iy; xor l; rlc h; jr c,+; (ld a,(ix+0); inc ix); ld (de),a; inc de; djnz -
+        auto outputDuplicate = [&](const uint8_t mask)
+        {
+            output(mask, 79, 103);
+        };
+
+        for (uint32_t tile = 0; tile < tileCount; ++tile)
+        {
+            // push bc; ld b,$04; ld de,buffer; ld c,(ix+0); inc ix
+            cycles += 57;
+            auto encoding = data.next();
+            for (int bitplane = 0; bitplane < 4; ++bitplane, encoding <<= 2)
+            {
+                // rlc c; jr nc,_AllTheSame
+                cycles += 8;
+                if ((encoding & 0x80) == 0)
+                {
+                    // Taken; rlc c; sbc a,a; ld l,a; ld h,$ff
+                    cycles += 12 + 8 + 4 + 4 + 7;
+                    outputCommonValue(0xff);
+                }
+                else if (encoding & 0x40)
+                {
+                    // Not taken; rlc c; jr c,_RawData taken; ld h,$00; jr _OutputCommonValue
+                    cycles += 7 + 8 + 12 + 7 + 12;
+                    outputCommonValue(0);
+                }
+                else
+                {
+                    // Not taken; rlc c; jr c,_RawData not taken; read the method byte and point iy at the bitplane
+                    cycles += 7 + 8 + 7 + 104;
+                    const auto method = data.next();
+                    // Then cp and jr c for each range until we find it
+                    constexpr uint8_t ranges[] = {0x03, 0x10, 0x13, 0x20, 0x23, 0x40, 0x43};
+                    int range = 0;
+                    while (range < 7 && method >= ranges[range])
+                    {
+                        cycles += 7 + 7;
+                        ++range;
+                    }
+                    if (range < 7)
+                    {
+                        cycles += 7 + 12;
+                    }
+                    switch (range)
+                    {
+                    case 0:
+                    case 2:
+                        // ld hl,$ff00 or $ffff; jr _OutputDuplicate
+                        cycles += 10 + 12;
+                        outputDuplicate(0xff);
+                        break;
+                    case 4:
+                        // ld h,(ix+0); ld l,$00; inc ix; jr _OutputDuplicate
+                        cycles += 19 + 7 + 10 + 12;
+                        outputDuplicate(data.next());
+                        break;
+                    case 6:
+                        // ld h,(ix+0); ld l,$ff; inc ix
+                        cycles += 19 + 7 + 10;
+                        outputDuplicate(data.next());
+                        break;
+                    default:
+                        // _CommonValue: ld h,a; ld l,(ix+0); inc ix; jr _OutputCommonValue
+                        cycles += 4 + 19 + 10 + 12;
+                        data.next();
+                        outputCommonValue(method);
+                        break;
+                    }
+                }
+                // dec b; jp nz,_DecompressBitplane
+                cycles += 4 + 10;
+            }
+            // Set the VRAM address and set up the loop
+            cycles += 72;
+            // Emit the 8 runs of 4 interleaved bytes
+            cycles += 8 * (7 + 11 + 4 * 42 - 5 + 10 + 6 + 4 + 12) - 5;
+            // Add 32 to the VRAM address; pop bc; dec bc; ld a,b; or c; jp nz,_DecompressTile
+            cycles += 53 + 10 + 6 + 4 + 4 + 10;
+        }
+        // ret
+        return cycles + 10;
+    }
+
+    // This is for the VRAM version of the decompressor
+    int64_t microMachines(Reader& data)
+    {
+        // Copies count bytes from ROM to VRAM with otir, as _ldir_rom_to_vram does
+        auto romToVram = [&](const uint32_t count)
+        {
+            for (auto i = 0u; i < count; ++i)
+            {
+                data.next();
+            }
+            // call _ldir_rom_to_vram; push af; add count to de; ld a,b; or a; jr nz,+
+            int64_t cycles = 17 + 11 + 4 + 11 + 4 + 4 + 4;
+            const auto low = count & 0xff;
+            if (count > 0xff)
+            {
+                // Taken; push bc; ld c,$be; ld b,0; otir, dec a, jp nz,- for each 256 bytes; pop bc; ld a,c; or a; jr z
+                cycles += 12 + 11 + 7 + 7 + (count >> 8) * (255 * 21 + 16 + 4 + 10) + 10 + 4 + 4;
+                if (low == 0)
+                {
+                    // Taken to pop af; ret
+                    return cycles + 12 + 10 + 10;
+                }
+                // Not taken; jp --
+                cycles += 7 + 10;
+            }
+            else
+            {
+                cycles += 7;
+            }
+            // ld b,c; ld c,$be; otir; pop af; ret
+            return cycles + 4 + 7 + ((low == 0 ? 256 : low) - 1) * 21 + 16 + 10 + 10;
+        };
+
+        // call _ldi_rom_to_vram, for a single literal byte
+        auto literal = [&]
+        {
+            data.next();
+            return 17 + 11 + 7 + 11 + 6 + 6 + 10 + 10;
+        };
+
+        // Set the VRAM address; jr _get_next_bitstream_byte_set_carry
+        int64_t cycles = 4 + 11 + 4 + 11 + 12;
+        // The bitstream byte is held in a, with a 1 bit after its data bits. We follow the code through its states,
+        // as the bit reading loop is unrolled.
+        enum class State
+        {
+            GetBitstreamByteSetCarry,
+            GetBitstreamByte,
+            GetBitstreamBit,
+            Bitstream1,
+            ByteStreamNextByte
+        };
+        auto state = State::GetBitstreamByteSetCarry;
+        uint8_t a = 0;
+        // Which of the unrolled bit reads we're at in _get_next_bitstream_bit
+        int bitIndex = 0;
+        for (;;)
+        {
+            switch (state)
+            {
+            case State::GetBitstreamByteSetCarry:
+                // scf
+                cycles += 4;
+                state = State::GetBitstreamByte;
+                break;
+            case State::GetBitstreamByte:
+            {
+                // ld a,(hl); inc hl; adc a,a with carry set; jr c,_bitstream1
+                const auto b = data.next();
+                a = static_cast<uint8_t>((b << 1) | 1);
+                cycles += 7 + 6 + 4;
+                if (b & 0x80)
+                {
+                    cycles += 12;
+                    state = State::Bitstream1;
+                }
+                else
+                {
+                    // _raw_single
+                    cycles += 7 + literal();
+                    bitIndex = 0;
+                    state = State::GetBitstreamBit;
+                }
+                break;
+            }
+            case State::GetBitstreamBit:
+            {
+                // add a,a; then jr c,_bitstream1 for the first 6, and jr nc for the last
+                const bool carry = (a & 0x80) != 0;
+                a = static_cast<uint8_t>(a << 1);
+                cycles += 4;
+                if (carry)
+                {
+                    cycles += bitIndex < 6 ? 12 : 7;
+                    state = State::Bitstream1;
+                }
+                else if (bitIndex < 6)
+                {
+                    cycles += 7 + literal();
+                    ++bitIndex;
+                }
+                else
+                {
+                    // _copy_byte_and_get_next_bitstream_byte_with_carry
+                    cycles += 12 + literal();
+                    state = State::GetBitstreamByteSetCarry;
+                }
+                break;
+            }
+            case State::Bitstream1:
+                // jr z,_get_next_bitstream_byte if we shifted out the marker bit
+                if (a == 0)
+                {
+                    cycles += 12;
+                    state = State::GetBitstreamByte;
+                }
+                else
+                {
+                    // ex af,af'
+                    cycles += 7 + 4;
+                    state = State::ByteStreamNextByte;
+                }
+                break;
+            case State::ByteStreamNextByte:
+            {
+                // ld a,(hl); cp $80; jr nc,_tiny_lz
+                const auto token = data.next();
+                cycles += 7 + 7;
+                // Most of them return to _get_next_bitstream_bit after ex af,af' and a jump
+                state = State::GetBitstreamBit;
+                bitIndex = 0;
+                if (token >= 0x80)
+                {
+                    // Taken; cp $ff; ret z
+                    cycles += 12 + 7;
+                    if (token == 0xff)
+                    {
+                        return cycles + 11;
+                    }
+                    // Work out the count and offset from the token; jp _copycplusonebytes; make bc = count; then the
+                    // copy; pop hl; inc hl; ex af,af'; jr _get_next_bitstream_bit
+                    cycles += 5 + 93 + 32 + ldirVramToVram(((token >> 5) & 3) + 2u) + 10 + 6 + 4 + 12;
+                    break;
+                }
+                // Not taken; inc hl; sub $70; jr nc,_counting
+                cycles += 7 + 6 + 7;
+                const auto x = token & 0x0f;
+                if (token >= 0x70)
+                {
+                    // Counting: taken; sub $0f; jr nz,+, where $f means the count is in the next byte
+                    cycles += 12 + 7;
+                    uint32_t count;
+                    if (x == 0x0f)
+                    {
+                        count = (data.next() + 0x11) & 0xff;
+                        cycles += 7 + 7 + 6;
+                    }
+                    else
+                    {
+                        count = x + 2u;
+                        cycles += 12;
+                    }
+                    // add a,$11; ld b,a; read the previous byte and set the VRAM address; then inc a; out ($be),a;
+                    // inc de; djnz - for each byte, where 0 means 256; ex af,af'; jp _get_next_bitstream_bit
+                    cycles += 126 + (count == 0 ? 256 : count) * 34 - 5 + 4 + 10;
+                    break;
+                }
+                // Not taken; add a,$10; jr c,_reverse_lz
+                cycles += 7 + 7;
+                if (token >= 0x60)
+                {
+                    // Taken, then set up; copy x+3 bytes backwards; pop hl; inc hl; ex af,af'; jr --; jp
+                    data.next();
+                    cycles += 12 + 75 + (x + 3) * 95 - 5 + 10 + 6 + 4 + 12 + 10;
+                    break;
+                }
+                // Not taken; add a,$10; jr c,_large_lz
+                cycles += 7 + 7;
+                if (token >= 0x50)
+                {
+                    // Taken; cp $0f; jr nz,_large_lz_use_a, where $f means there's another offset byte
+                    cycles += 12 + 7;
+                    if (x == 0x0f)
+                    {
+                        // Not taken; ld b,(hl); inc hl; jr _large_lz_use_b
+                        data.next();
+                        cycles += 7 + 7 + 6 + 12;
+                    }
+                    else
+                    {
+                        // Taken; ld b,a
+                        cycles += 12 + 4;
+                    }
+                    // Then the offset and count bytes; make bc = count + 4; jr _copybcbytes; the copy; pop hl;
+                    // inc hl; ex af,af'; jr _get_next_bitstream_bit
+                    data.next();
+                    const auto count = data.next() + 4u;
+                    cycles += 126 + ldirVramToVram(count) + 10 + 6 + 4 + 12;
+                    break;
+                }
+                // Not taken; add a,$30; jp c,_small_lz
+                cycles += 7 + 7 + 10;
+                if (token >= 0x20)
+                {
+                    // Work out the count and offset; make bc = count; the copy; pop hl; inc hl; ex af,af';
+                    // jr _get_next_bitstream_bit
+                    data.next();
+                    cycles += 105 + 32 + ldirVramToVram(x + 3u) + 10 + 6 + 4 + 12;
+                    break;
+                }
+                // add a,$10; jp nc,_raw
+                cycles += 7 + 10;
+                if (token >= 0x10)
+                {
+                    // RLE: ld b,$00; sub $0f; jr z,++, where $f means there's a count byte
+                    cycles += 7 + 7;
+                    uint32_t count;
+                    if (x == 0x0f)
+                    {
+                        // ld a,(hl); inc hl; add a,$11; jr nc,_duplicate_previous_byte_ba_times, else inc b; jr
+                        const auto b = data.next();
+                        count = (b + 0x11) & 0xff;
+                        cycles += 12 + 7 + 6 + 7 + (b + 0x11 > 0xff ? 7 + 4 + 12 : 12);
+                    }
+                    else
+                    {
+                        // add a,$11
+                        count = x + 2u;
+                        cycles += 7 + 7;
+                    }
+                    // Make bc = count, where 0 means 256 (and any high byte is lost); jr z,+; inc b if not taken
+                    cycles += 38 + (count == 0 ? 12 : 7 + 4);
+                    // Read the previous byte and set the VRAM address; then out ($be),a; inc de; dec c; jr nz,- for
+                    // each byte, then djnz -; ex af,af'; jr _get_next_bitstream_bit
+                    cycles += 115 + (count == 0 ? 256 : count) * 33 - 5 + 8 + 4 + 12;
+                    break;
+                }
+
+                // Raw: ld b,$00; inc a; jr z,_0f
+                cycles += 7 + 4;
+                if (x != 0x0f)
+                {
+                    // Not taken; make bc = x+8; call _ldir_rom_to_vram
+                    cycles += 7 + 11 + 4 + 10 + 11 + 4 + 4 + 10 + romToVram(x + 8u);
+                }
+                else
+                {
+                    // Taken; ld a,(hl); inc hl; inc a; jr z,_0fff
+                    const auto b = data.next();
+                    cycles += 12 + 7 + 6 + 4;
+                    if (b == 0xff)
+                    {
+                        // Taken; read the count to bc
+                        const auto count = data.nextWord();
+                        cycles += 12 + 7 + 6 + 7 + 6 + romToVram(static_cast<uint32_t>(count));
+                    }
+                    else
+                    {
+                        // Not taken; make bc = count + 30
+                        cycles += 7 + 11 + 7 + 4 + 10 + 11 + 4 + 4 + 10 + romToVram(b + 30u);
+                    }
+                }
+                // jp _byte_stream_next_byte
+                cycles += 10;
+                state = State::ByteStreamNextByte;
+                break;
+            }
+            }
+        }
+    }
+
+    int64_t shiningForceGaiden(Reader& data)
+    {
+        // It's called with bc = data and hl = VRAM address, after paging in the RAM it decompresses to
+        int64_t cycles = 20 + 10;
+        // Set the VRAM address; push de
+        cycles += 30 + 11;
+        uint32_t outputLength = 0;
+        uint8_t controlBits = 0;
+        bool isLiteral = false;
+        for (;;)
+        {
+            if (controlBits == 0)
+            {
+                // ld a,(bc); inc bc; ld h,a; scf; rr h; jr nc,_lz
+                const auto b = data.next();
+                isLiteral = b & 1;
+                controlBits = static_cast<uint8_t>((b >> 1) | 0x80);
+                cycles += 29 + (isLiteral ? 7 : 12);
+            }
+            if (isLiteral)
+            {
+                // ld a,(bc); inc bc; ld (de),a; inc de
+                data.next();
+                cycles += 26;
+                ++outputLength;
+            }
+            else
+            {
+                // push hl; read the word; or l; jr z,_interleave
+                const auto low = data.next();
+                const auto high = data.next();
+                if (low == 0 && high == 0)
+                {
+                    cycles += 49 + 12;
+                    break;
+                }
+                // Work out the source, then ldir; ldi; ldi; then pop bc; pop hl; jp --
+                const uint32_t count = (high & 0x1f) + 1u;
+                cycles += 49 + 7 + 75 + 21 * (count - 1) + 16 + 32 + 30;
+                outputLength += count + 2;
+            }
+            // srl h; jr z,_nextControlByte; jp c,_copyLiteral
+            isLiteral = controlBits & 1;
+            controlBits >>= 1;
+            cycles += 8 + (controlBits == 0 ? 12 : 7 + 10);
+        }
+
+        // pop hl; ex de,hl; pop de; or a; sbc hl,de; ex de,hl; then divide by 32
+        cycles += 10 + 4 + 10 + 4 + 15 + 4 + 80;
+        // Each tile is copied to VRAM as 8 groups of 4 bytes, each taking 142 cycles, then we move on and loop
+        const auto tileCount = outputLength / 32;
+        cycles += tileCount * (8 * 142 + 45);
+        return cycles + 10;
+    }
+
+    // This is called with ix pointing at the end of the data, which is how it knows when to stop
+    int64_t lz4(Reader& data)
+    {
+        // Adds the length bytes following a nibble of 15 to length: ld c,(hl); inc hl; add a,c; jr nc,+; ccf; inc b;
+        // inc c; jr z,_Calcloop
+        int64_t cycles = 0;
+        auto extendLength = [&](uint32_t length)
+        {
+            for (;;)
+            {
+                const auto b = data.next();
+                cycles += 7 + 6 + 4 + ((length & 0xff) + b > 0xff ? 7 + 4 + 4 : 12) + 4;
+                length += b;
+                if (b != 0xff)
+                {
+                    cycles += 7;
+                    return length;
+                }
+                cycles += 12;
+            }
+        };
+
+        // ld ix,dataend; set the VRAM address; ld b,0
+        cycles += 14 + 7 + 12 + 12 + 7;
+        for (;;)
+        {
+            // _GetToken: ld a,(hl); inc hl; ld c,a; cp $10; jr c,_CopyMatches
+            const auto token = data.next();
+            cycles += 7 + 6 + 4 + 7;
+            if (token >= 0x10)
+            {
+                // Not taken; ex af,af'; ld a,c; and $f0; rlca x 4; cp $f; jr nz,_CopyLiterals
+                cycles += 7 + 4 + 4 + 7 + 16 + 7;
+                uint32_t count = token >> 4;
+                if (count == 0xf)
+                {
+                    cycles += 7;
+                    count = extendLength(count);
+                }
+                else
+                {
+                    cycles += 12;
+                }
+                for (auto i = 0u; i < count; ++i)
+                {
+                    data.next();
+                }
+                // ld c,a; then ld a,(hl); out ($be),a; inc hl; inc de; dec bc; ld a,b; or c; jp nz,- per byte;
+                // ex af,af'
+                cycles += 4 + count * 54 + 4;
+            }
+            else
+            {
+                cycles += 12;
+            }
+            // _CopyMatches: ex af,af'; ld a,ixl; cp l; jr nz,_GetOffset
+            cycles += 4 + 8 + 4;
+            if (data.remaining() % 256 == 0)
+            {
+                // Not taken; ld a,ixh; cp h; ret z
+                cycles += 7 + 8 + 4;
+                if (data.remaining() == 0)
+                {
+                    return cycles + 11;
+                }
+                cycles += 5;
+            }
+            else
+            {
+                cycles += 12;
+            }
+            // _GetOffset: ex af,af'; and $f; add a,4; read the offset; push hl; ld h,d; ld l,e; sbc hl,bc; ld b,0;
+            // ld c,a; cp $f+4; jr nz,_copymatch
+            data.next();
+            data.next();
+            cycles += 4 + 7 + 7 + 7 + 6 + 7 + 6 + 11 + 4 + 4 + 15 + 7 + 4 + 7;
+            uint32_t count = (token & 0xf) + 4u;
+            if (count == 0xf + 4)
+            {
+                // Not taken; ex (sp),hl; the length bytes; ld c,a; ex (sp),hl
+                cycles += 7 + 19;
+                count = extendLength(count);
+                cycles += 4 + 19;
+            }
+            else
+            {
+                cycles += 12;
+            }
+            // The copy; pop hl; jr _GetToken
+            cycles += ldirVramToVram(count) + 10 + 12;
+        }
+    }
+
+    // This is for the fast decompressor
+    int64_t zx0(Reader& data)
+    {
+        // As in Micro Machines, we follow the code through its states, as it reads the bits in pairs from a with
+        // different entry points depending on where the byte boundaries fall. We also track b and c, as they
+        // accumulate the Elias gamma values.
+        int64_t cycles = 0;
+        uint8_t a = 0x80;
+        uint8_t b = 0;
+        uint8_t c = 0;
+        bool carry = false;
+        bool zero = false;
+
+        // add a,a
+        auto addA = [&]
+        {
+            carry = (a & 0x80) != 0;
+            a = static_cast<uint8_t>(a << 1);
+            zero = a == 0;
+            cycles += 4;
+        };
+        // ld a,(hl); inc hl; rla
+        auto reload = [&]
+        {
+            const auto value = data.next();
+            const bool carryIn = carry;
+            carry = (value & 0x80) != 0;
+            a = static_cast<uint8_t>((value << 1) | (carryIn ? 1 : 0));
+            cycles += 7 + 6 + 4;
+        };
+        // rl r
+        auto rotateLeft = [&](uint8_t& r)
+        {
+            const bool carryIn = carry;
+            carry = (r & 0x80) != 0;
+            r = static_cast<uint8_t>((r << 1) | (carryIn ? 1 : 0));
+            cycles += 8;
+        };
+        // rr r
+        auto rotateRight = [&](uint8_t& r)
+        {
+            const bool carryIn = carry;
+            carry = (r & 1) != 0;
+            r = static_cast<uint8_t>((r >> 1) | (carryIn ? 0x80 : 0));
+            cycles += 8;
+        };
+        // -: add a,a; rl c; add a,a; jr nc,-
+        auto inlineReadGamma = [&]
+        {
+            do
+            {
+                addA();
+                rotateLeft(c);
+                addA();
+                cycles += carry ? 7 : 12;
+            }
+            while (!carry);
+        };
+        // ReadGammaAligned, from after the call to its ret
+        auto readGammaAligned = [&]
+        {
+            // add a,a; rl c; add a,a; ret c
+            addA();
+            rotateLeft(c);
+            addA();
+            if (carry)
+            {
+                cycles += 11;
+                return;
+            }
+            // Not taken; add a,a; rl c; add a,a
+            cycles += 5;
+            addA();
+            rotateLeft(c);
+            addA();
+            for (;;)
+            {
+                // ReadingLongGamma: ret c
+                if (carry)
+                {
+                    cycles += 11;
+                    return;
+                }
+                // Not taken; add a,a; rl c; rl b; add a,a; jr nz,ReadingLongGamma
+                cycles += 5;
+                addA();
+                rotateLeft(c);
+                rotateLeft(b);
+                addA();
+                if (zero)
+                {
+                    // Not taken, reload; jr ReadingLongGamma
+                    cycles += 7;
+                    reload();
+                    cycles += 12;
+                }
+                else
+                {
+                    cycles += 12;
+                }
+            }
+        };
+        // ReloadReadGamma, from after the call to its ret
+        auto reloadReadGamma = [&]
+        {
+            // Reload; ret c
+            reload();
+            if (carry)
+            {
+                cycles += 11;
+                return;
+            }
+            cycles += 5;
+            readGammaAligned();
+        };
+        // call _ldir_rom_to_vram, which copies bc bytes and leaves bc = 0
+        auto romToVram = [&]
+        {
+            const uint32_t count = (b << 8) | c;
+            for (auto i = 0u; i < count; ++i)
+            {
+                data.next();
+            }
+            // call _ldir_rom_to_vram; push af; add bc to de; ld a,b; or a; jr nz,+
+            cycles += 17 + 11 + 4 + 11 + 4 + 4 + 4;
+            if (b != 0)
+            {
+                // Taken; push bc; ld c,$be; ld b,0; otir, dec a, jp nz,- for each 256 bytes; pop bc; ld a,c; or a;
+                // jr z,---
+                cycles += 12 + 11 + 7 + 7 + b * (255 * 21 + 16 + 4 + 10) + 10 + 4 + 4;
+                if (c == 0)
+                {
+                    cycles += 12;
+                }
+                else
+                {
+                    // Not taken; jp --; ld b,c; ld c,$be; otir
+                    cycles += 7 + 10 + 4 + 7 + (c - 1) * 21 + 16;
+                }
+            }
+            else
+            {
+                // Not taken; ld b,c; ld c,$be; otir (where 0 means 256)
+                cycles += 7 + 4 + 7 + ((c == 0 ? 256 : c) - 1) * 21 + 16;
+            }
+            // pop af; ld c,0; ret
+            cycles += 10 + 7 + 10;
+            b = 0;
+            c = 0;
+        };
+        // call _ldir_vram_to_vram, which copies bc bytes and leaves bc = 0
+        auto vramToVram = [&]
+        {
+            // call _ldir_vram_to_vram; push af; res 6,h; ld a,b; or a; jr nz,++
+            cycles += 17 + 11 + 8 + 4 + 4;
+            // Each byte: out (c),l; out (c),h; in a,($be); out (c),e; out (c),d; out ($be),a; inc hl; inc de; djnz -
+            constexpr int perByte = 95;
+            if (b == 0)
+            {
+                // Not taken; ld b,c; ld c,$bf; the bytes (where 0 means 256)
+                cycles += 7 + 4 + 7 + (c == 0 ? 256 : c) * perByte - 5;
+            }
+            else
+            {
+                // Taken; push bc; ld c,$bf; ld b,0; 256 bytes; pop bc; djnz -- for each 256; ld a,c; or a; jr nz,---
+                cycles += 12 + b * (11 + 7 + 7 + 256 * perByte - 5 + 10 + 13) - 5 + 4 + 4;
+                if (c == 0)
+                {
+                    // Not taken; jp _done
+                    cycles += 7 + 10;
+                }
+                else
+                {
+                    // Taken; ld b,c; ld c,$bf; the bytes
+                    cycles += 12 + 4 + 7 + c * perByte - 5;
+                }
+            }
+            // _done: pop af; ld c,0; ret
+            cycles += 10 + 7 + 10;
+            b = 0;
+            c = 0;
+        };
+
+        enum class State
+        {
+            RunOfLiterals,
+            RepMatch,
+            UsualMatch,
+            ShorterOffsets,
+            LongerOffsets,
+            LongerMatch,
+            CopyMatch1,
+            CopyMatch2
+        };
+
+        // Set the VRAM address; ld ix,CopyMatch1; ld bc,$ffff; ld (PrevOffset+1),bc; inc bc; ld a,$80;
+        // jr RunOfLiterals
+        cycles += 7 + 12 + 12 + 14 + 10 + 20 + 6 + 7 + 12;
+        auto state = State::RunOfLiterals;
+        for (;;)
+        {
+            switch (state)
+            {
+            case State::RunOfLiterals:
+            {
+                // inc c; add a,a; jr nc,LongerRun; jr nz,CopyLiteral; reload; jr c,CopyLiteral
+                ++c;
+                cycles += 4;
+                addA();
+                bool longerRun = !carry;
+                if (carry)
+                {
+                    cycles += 7;
+                    if (zero)
+                    {
+                        cycles += 7;
+                        reload();
+                        longerRun = !carry;
+                    }
+                    cycles += longerRun ? 7 : 12;
+                }
+                else
+                {
+                    cycles += 12;
+                }
+                if (longerRun)
+                {
+                    // LongerRun: the gamma; jr nz,CopyLiterals; reload; call nc,ReadGammaAligned
+                    inlineReadGamma();
+                    if (!zero)
+                    {
+                        cycles += 12;
+                    }
+                    else
+                    {
+                        cycles += 7;
+                        reload();
+                        if (carry)
+                        {
+                            cycles += 10;
+                        }
+                        else
+                        {
+                            cycles += 17;
+                            readGammaAligned();
+                        }
+                    }
+                }
+                romToVram();
+                // add a,a; jr c,UsualMatch
+                addA();
+                cycles += carry ? 12 : 7;
+                state = carry ? State::UsualMatch : State::RepMatch;
+                break;
+            }
+            case State::RepMatch:
+                // inc c; add a,a; jr nc,LongerRepMatch; jr nz,CopyMatch1; reload; jr c,CopyMatch1
+                ++c;
+                cycles += 4;
+                addA();
+                if (carry)
+                {
+                    cycles += 7;
+                    if (!zero)
+                    {
+                        cycles += 12;
+                        state = State::CopyMatch1;
+                        break;
+                    }
+                    cycles += 7;
+                    reload();
+                    if (carry)
+                    {
+                        cycles += 12;
+                        state = State::CopyMatch1;
+                        break;
+                    }
+                    cycles += 7;
+                }
+                else
+                {
+                    cycles += 12;
+                }
+                // LongerRepMatch: the gamma; jp nz,CopyMatch1; push ix; ReloadReadGamma, which returns to CopyMatch1
+                inlineReadGamma();
+                cycles += 10;
+                if (zero)
+                {
+                    cycles += 15;
+                    reloadReadGamma();
+                }
+                state = State::CopyMatch1;
+                break;
+            case State::UsualMatch:
+                // add a,a; jr nc,LongerOffets; jr nz,ShorterOffsets; reload; jr c,ShorterOffsets
+                addA();
+                if (carry)
+                {
+                    cycles += 7;
+                    if (!zero)
+                    {
+                        cycles += 12;
+                        state = State::ShorterOffsets;
+                        break;
+                    }
+                    cycles += 7;
+                    reload();
+                    cycles += carry ? 12 : 7;
+                    state = carry ? State::ShorterOffsets : State::LongerOffsets;
+                }
+                else
+                {
+                    cycles += 12;
+                    state = State::LongerOffsets;
+                }
+                break;
+            case State::ShorterOffsets:
+                // ld b,$ff; ld c,(hl); inc hl; rr c; ld (PrevOffset+1),bc; jr nc,LongerMatch
+                b = 0xff;
+                c = data.next();
+                cycles += 7 + 7 + 6;
+                rotateRight(c);
+                cycles += 20 + (carry ? 7 : 12);
+                state = carry ? State::CopyMatch2 : State::LongerMatch;
+                break;
+            case State::LongerOffsets:
+                // ld c,$fe; the gamma; call z,ReloadReadGamma
+                c = 0xfe;
+                cycles += 7;
+                inlineReadGamma();
+                if (zero)
+                {
+                    cycles += 17;
+                    reloadReadGamma();
+                }
+                else
+                {
+                    cycles += 10;
+                }
+                // ProcessOffset: inc c; ret z
+                ++c;
+                cycles += 4;
+                if (c == 0)
+                {
+                    return cycles + 11;
+                }
+                // rr c; ld b,c; ld c,(hl); inc hl; rr c; ld (PrevOffset+1),bc; jr c,CopyMatch2
+                cycles += 5;
+                rotateRight(c);
+                b = c;
+                c = data.next();
+                cycles += 4 + 7 + 6;
+                rotateRight(c);
+                cycles += 20 + (carry ? 12 : 7);
+                state = carry ? State::CopyMatch2 : State::LongerMatch;
+                break;
+            case State::LongerMatch:
+                // ld bc,1; the gamma; call z,ReloadReadGamma
+                b = 0;
+                c = 1;
+                cycles += 10;
+                inlineReadGamma();
+                if (zero)
+                {
+                    cycles += 17;
+                    reloadReadGamma();
+                }
+                else
+                {
+                    cycles += 10;
+                }
+                // CopyMatch3: push hl; ld hl,(PrevOffset+1); add hl,de; inc bc; the copy; pop hl
+                if (++c == 0)
+                {
+                    ++b;
+                }
+                cycles += 11 + 16 + 11 + 6;
+                vramToVram();
+                cycles += 10;
+                // AfterMatch3: add a,a; jr c,UsualMatch
+                addA();
+                cycles += carry ? 12 : 7;
+                state = carry ? State::UsualMatch : State::RunOfLiterals;
+                break;
+            case State::CopyMatch2:
+                // ld bc,2
+                b = 0;
+                c = 2;
+                cycles += 10;
+                [[fallthrough]];
+            case State::CopyMatch1:
+                // push hl; ld hl,(PrevOffset+1); add hl,de; the copy; pop hl
+                cycles += 11 + 16 + 11;
+                vramToVram();
+                cycles += 10;
+                // AfterMatch1: add a,a; jr nc,RunOfLiterals
+                addA();
+                cycles += carry ? 7 : 12;
+                state = carry ? State::UsualMatch : State::RunOfLiterals;
+                break;
+            }
+        }
+    }
+
+    // Copies count bytes from ROM to VRAM, as _ldir_rom_to_vram does in the LZSA decompressors
+    int64_t lzsaRomToVram(Reader& data, const uint32_t count)
+    {
+        for (auto i = 0u; i < count; ++i)
+        {
+            data.next();
+        }
+        // call _ldir_rom_to_vram; add count to de; ld a,b; or a; jr nz,+
+        int64_t cycles = 17 + 4 + 11 + 4 + 4 + 4;
+        const auto low = count & 0xff;
+        if (count > 0xff)
+        {
+            // Taken; push bc; ld c,$be; ld b,0; otir, dec a, jp nz,- for each 256 bytes; pop bc; ld a,c; or a; ret z
+            cycles += 12 + 11 + 7 + 7 + (count >> 8) * (255 * 21 + 16 + 4 + 10) + 10 + 4 + 4;
+            if (low == 0)
+            {
+                return cycles + 11;
+            }
+            // Not taken; jp --
+            cycles += 5 + 10;
+        }
+        else
+        {
+            cycles += 7;
+        }
+        // ld b,c; ld c,$be; otir; ret
+        return cycles + 4 + 7 + (low - 1) * 21 + 16 + 10;
+    }
+
+    // Copies count bytes within VRAM, as the LZSA decompressors do from _CopyMatch@UseBC up to _CopyMatch_Done. They
+    // differ in how they jump back after the 256 byte blocks.
+    int64_t lzsaVramToVram(const uint32_t count, const bool isLzsa2)
+    {
+        // ex (sp),hl; ex de,hl; add hl,de; res 6,h; ld a,b; or a; jr nz,_copy_256b_bytes_vram_to_vram
+        int64_t cycles = 19 + 4 + 11 + 8 + 4 + 4;
+        // Each byte: out (c),l; out (c),h; in a,($be); out (c),e; out (c),d; out ($be),a; inc hl; inc de; djnz -
+        constexpr int perByte = 95;
+        const auto low = count & 0xff;
+        if (count > 0xff)
+        {
+            // Taken; push bc; ld b,0; ld c,$bf; 256 bytes; pop bc; djnz -- for each 256; ld a,c; or a
+            cycles += 12 + (count >> 8) * (11 + 7 + 7 + 256 * perByte - 5 + 10 + 13) - 5 + 4 + 4;
+            if (low == 0)
+            {
+                // LZSA1 takes jp z,_CopyMatch_Done; LZSA2 doesn't take jp nz,_copy_c_bytes_vram_to_vram and jumps
+                return cycles + (isLzsa2 ? 10 + 10 : 10);
+            }
+            // The reverse
+            cycles += isLzsa2 ? 10 : 10 + 10;
+        }
+        else
+        {
+            cycles += 7;
+        }
+        // _copy_c_bytes_vram_to_vram: ld b,c; ld c,$bf; the bytes
+        return cycles + 4 + 7 + low * perByte - 5;
+    }
+
+    int64_t lzsa1(Reader& data)
+    {
+        // Set the VRAM address; ld b,0; jp _ReadToken
+        int64_t cycles = 7 + 12 + 12 + 7 + 10;
+        for (;;)
+        {
+            // _ReadToken: ld a,(hl); and %01110000; jr z,_NoLiterals
+            const auto token = data.next();
+            const auto literals = (token >> 4) & 7u;
+            cycles += 7 + 7;
+            if (literals == 0)
+            {
+                // Taken; xor (hl); inc hl; jp m,_LongOffset
+                cycles += 12 + 7 + 6 + 10;
+            }
+            else if (literals < 7)
+            {
+                // Not taken; cp %01110000; jr z,_MoreLiterals not taken; rrca x 4; ld c,a; ld a,(hl); inc hl;
+                // ex af,af'; the copy; ex af,af'; and %10001111; jp p,_ShortOffset
+                cycles += 7 + 7 + 7 + 16 + 4 + 7 + 6 + 4 + lzsaRomToVram(data, literals) + 4 + 7 + 10;
+            }
+            else
+            {
+                // Not taken; cp %01110000; jr z,_MoreLiterals taken; xor (hl); inc hl; ex af,af'; ld a,7; add (hl);
+                // jr c,_ManyLiterals
+                const auto extra = data.next();
+                cycles += 7 + 7 + 12 + 7 + 6 + 4 + 7 + 7;
+                uint32_t count;
+                if (extra + 7u <= 0xff)
+                {
+                    // Not taken; ld c,a
+                    count = extra + 7u;
+                    cycles += 7 + 4;
+                }
+                else
+                {
+                    // Taken; ld b,a; inc hl; ld c,(hl); jp nz,_CopyLiterals, where 0 means there's another byte;
+                    // inc hl; ld b,(hl); jp _CopyLiterals
+                    const auto low = data.next();
+                    cycles += 12 + 4 + 6 + 7 + 10;
+                    if (extra + 7u == 0x100)
+                    {
+                        count = low | (data.next() << 8);
+                        cycles += 6 + 7 + 10;
+                    }
+                    else
+                    {
+                        count = ((extra + 7u) & 0xff) << 8 | low;
+                    }
+                }
+                // _CopyLiterals: inc hl; the copy; ex af,af'; jp p,_ShortOffset; jp _LongOffset
+                cycles += 6 + lzsaRomToVram(data, count) + 4 + 10 + (token & 0x80 ? 10 : 0);
+            }
+
+            uint32_t count = (token & 0xf) + 3u;
+            if (token & 0x80)
+            {
+                // _LongOffset: push de; ld e,(hl); inc hl; ld d,(hl); add -128+3; cp 15+3; jp c,_CopyMatch
+                data.next();
+                data.next();
+                cycles += 11 + 7 + 6 + 7 + 7 + 7 + 10;
+            }
+            else
+            {
+                // _ShortOffset: push de; ld e,(hl); ld d,$ff; add 3; cp 15+3; jr nc,_LongerMatch
+                data.next();
+                cycles += 11 + 7 + 7 + 7 + 7 + (count == 15 + 3 ? 12 : 7);
+            }
+            if (count == 15 + 3)
+            {
+                // _LongerMatch: inc hl; add (hl); jp nc,_CopyMatch
+                const auto extra = data.next();
+                cycles += 6 + 7 + 10;
+                if (extra + count <= 0xff)
+                {
+                    // _CopyMatch: ld c,a; inc hl
+                    count += extra;
+                    cycles += 4 + 6;
+                }
+                else
+                {
+                    // ld b,a; inc hl; ld c,(hl); jp nz,_CopyMatch@UseBC, where 0 means there's another byte
+                    const auto low = data.next();
+                    cycles += 4 + 6 + 7 + 10;
+                    if (extra + count == 0x100)
+                    {
+                        // inc hl; ld b,(hl); ld a,b; or c; jr nz,_CopyMatch@UseBC, where 0 is the end marker
+                        count = low | (data.next() << 8);
+                        cycles += 6 + 7 + 4 + 4;
+                        if (count == 0)
+                        {
+                            // Not taken; pop de; ret
+                            return cycles + 7 + 10 + 10;
+                        }
+                        cycles += 12;
+                    }
+                    else
+                    {
+                        count = ((extra + count) & 0xff) << 8 | low;
+                    }
+                    // @UseBC: inc hl
+                    cycles += 6;
+                }
+            }
+            else
+            {
+                // _CopyMatch: ld c,a; inc hl
+                cycles += 4 + 6;
+            }
+            // The copy; pop hl
+            cycles += lzsaVramToVram(count, false) + 10;
+        }
+    }
+
+    int64_t lzsa2(Reader& data)
+    {
+        // The nibbles are read in pairs, with the second one kept in a' until it's needed. The carry flag in f' tells
+        // us if it's there.
+        int64_t cycles = 0;
+        bool haveNibble = false;
+        uint8_t nextNibble = 0;
+        // ex af,af'; jr nc,+; and if not taken, ld a,(hl); or $f0; ex af,af'; ld a,(hl); inc hl; or $0f; rrca x 4
+        auto readNibble = [&]
+        {
+            if (haveNibble)
+            {
+                haveNibble = false;
+                cycles += 4 + 12;
+                return nextNibble;
+            }
+            const auto b = data.next();
+            haveNibble = true;
+            nextNibble = b & 0xf;
+            cycles += 4 + 7 + 7 + 7 + 4 + 7 + 6 + 7 + 16;
+            return static_cast<uint8_t>(b >> 4);
+        };
+        // _ldir_rom_to_vram_c_only: ld b,0; add count to de; ld b,c; ld c,$be; otir; ret
+        auto romToVramCOnly = [&](const uint32_t count)
+        {
+            for (auto i = 0u; i < count; ++i)
+            {
+                data.next();
+            }
+            return 17 + 7 + 4 + 11 + 4 + 4 + 7 + (count - 1) * 21 + 16 + 10;
+        };
+
+        // Set the VRAM address; ld b,0; scf; ex af,af'; jp _ReadToken
+        cycles += 7 + 12 + 12 + 7 + 4 + 4 + 10;
+        for (;;)
+        {
+            // _ReadToken: ld a,(hl); and %00011000; jp pe,_Literals0011
+            const auto token = data.next();
+            const auto literals = (token >> 3) & 3u;
+            const auto offsetType = token >> 5;
+            cycles += 7 + 7 + 10;
+            // Where we end up after the literals depends on how we got there, so we add the cost of getting to the
+            // _CASE label for the offset type
+            if (literals == 1 || literals == 2)
+            {
+                // rrca x 3; ld c,a; ld a,(hl); inc hl; push af; the copy; pop af; push de; or a; jp p,_CASE0xx;
+                // cp %11000000; jr nc,_CASE11x
+                cycles += 12 + 4 + 7 + 6 + 11 + lzsaRomToVram(data, literals) + 10 + 11 + 4 + 10;
+                if (offsetType >= 4)
+                {
+                    cycles += 7 + (offsetType >= 6 ? 12 : 7);
+                }
+            }
+            else if (literals == 0)
+            {
+                // _Literals0011: jr nz,_MoreLiterals not taken; _NoLiterals: or (hl); inc hl; push de;
+                // jp m,_CASE1xx; cp %11000000; jr nc,_CASE11x
+                cycles += 7 + 7 + 6 + 11 + 10;
+                if (offsetType >= 4)
+                {
+                    cycles += 7 + (offsetType >= 6 ? 12 : 7);
+                }
+            }
+            else
+            {
+                // jr nz,_MoreLiterals taken; ld b,(hl); inc hl; scf; then the nibble; cp 15+3; jr z,_ManyLiterals
+                // not taken; inc a; jr z,_ManyLiterals
+                cycles += 12 + 7 + 6 + 4;
+                const auto nibble = readNibble();
+                cycles += 7 + 7 + 4;
+                uint32_t count = nibble + 3u;
+                bool isLong = false;
+                if (nibble == 0xf)
+                {
+                    // Taken; ld a,18; add (hl); inc hl; jp nc,_CopyLiterals
+                    const auto extra = data.next();
+                    cycles += 12 + 7 + 7 + 6 + 10;
+                    count = extra + 18u;
+                    if (count > 0xff)
+                    {
+                        // ld c,(hl); inc hl; ld a,b; ld b,(hl); jp _ReadToken@NEXTHLuseBC; inc hl; push af;
+                        // the copy; pop af; push de; or a; jp p,_CASE0xx; cp %11000000; jr nc,_CASE11x
+                        count = data.nextWord();
+                        cycles += 7 + 6 + 4 + 7 + 10 + 6 + 11 + lzsaRomToVram(data, count) + 10 + 11 + 4 + 10;
+                        if (offsetType >= 4)
+                        {
+                            cycles += 7 + (offsetType >= 6 ? 12 : 7);
+                        }
+                        isLong = true;
+                    }
+                }
+                else
+                {
+                    // Not taken; sub $f0-3+1
+                    cycles += 7 + 7;
+                }
+                if (!isLong)
+                {
+                    // _CopyLiterals: ld c,a; ld a,b; the copy; push de; or a; jp p,_CASE0xx; cp %11000000;
+                    // jr c,_CASE10x
+                    cycles += 4 + 4 + romToVramCOnly(count) + 11 + 4 + 10;
+                    if (offsetType >= 4)
+                    {
+                        cycles += 7 + (offsetType >= 6 ? 7 : 12);
+                    }
+                }
+            }
+
+            switch (offsetType)
+            {
+            case 0:
+            case 1:
+                // _CASE0xx: ld d,$ff; cp %01000000; jr c,_CASE00x taken; ld c,a; the nibble; ld e,a; ld a,c;
+                // cp %00100000; rl e; jp _SaveOffset
+                cycles += 7 + 7 + 12 + 4;
+                readNibble();
+                cycles += 4 + 4 + 7 + 8 + 10;
+                break;
+            case 2:
+            case 3:
+                // _CASE0xx: ld d,$ff; cp %01000000; jr c,_CASE00x not taken; cp %01100000; rl d; ld e,(hl); inc hl
+                data.next();
+                cycles += 7 + 7 + 7 + 7 + 8 + 7 + 6;
+                break;
+            case 4:
+            case 5:
+                // _CASE10x: ld c,a; the nibble; ld d,a; ld a,c; cp %10100000; dec d; rl d; jp _ReadOffsetE;
+                // ld e,(hl); inc hl
+                cycles += 4;
+                readNibble();
+                data.next();
+                cycles += 4 + 4 + 7 + 4 + 8 + 10 + 7 + 6;
+                break;
+            case 6:
+                // _CASE11x: cp %11100000; jr c,_CASE110 taken; ld d,(hl); inc hl; jp _ReadOffsetE; ld e,(hl); inc hl
+                data.next();
+                data.next();
+                cycles += 7 + 12 + 7 + 6 + 10 + 7 + 6;
+                break;
+            default:
+                // _CASE11x: cp %11100000; jr c,_CASE110 not taken; ld e,ixl; ld d,ixh; jp _MatchLen
+                cycles += 7 + 7 + 8 + 8 + 10;
+                break;
+            }
+            if (offsetType != 7)
+            {
+                // _SaveOffset: ld ixl,e; ld ixh,d
+                cycles += 8 + 8;
+            }
+
+            // _MatchLen: inc a; and %00000111; jr z,_LongerMatch
+            cycles += 4 + 7;
+            uint32_t count = (token & 7u) + 2;
+            if (count != 7 + 2)
+            {
+                // Not taken; inc a; _CopyMatch: ld c,a
+                cycles += 7 + 4 + 4;
+            }
+            else
+            {
+                // Taken; scf; the nibble; sub $f0-9; cp 15+9; jp c,_CopyMatch
+                cycles += 12 + 4;
+                count = readNibble() + 9u;
+                cycles += 7 + 7 + 10;
+                if (count != 15 + 9)
+                {
+                    // ld c,a
+                    cycles += 4;
+                }
+                else
+                {
+                    // _LongMatch: add (hl); inc hl; jp nc,_CopyMatch
+                    const auto extra = data.next();
+                    cycles += 7 + 6 + 10;
+                    if (extra + count <= 0xff)
+                    {
+                        // ld c,a
+                        count += extra;
+                        cycles += 4;
+                    }
+                    else
+                    {
+                        // ld c,(hl); inc hl; ld b,(hl); inc hl; jp nz,_CopyMatch@useBC, where 0 is the end marker
+                        const bool isEnd = extra + count == 0x100;
+                        const auto low = data.nextOrZero();
+                        count = low | (data.nextOrZero() << 8);
+                        cycles += 7 + 6 + 7 + 6 + 10;
+                        if (isEnd)
+                        {
+                            // pop de; ret
+                            return cycles + 10 + 10;
+                        }
+                    }
+                }
+            }
+            // The copy; @popSrc: pop hl
+            cycles += lzsaVramToVram(count, true) + 10;
+        }
+    }
+
+    // This is for the fast decompressor. The other one reads the same format, so we use this for both.
+    int64_t aPLib(Reader& data)
+    {
+        // As for ZX0, we follow the code with a, b, c and the flags, as the bit reads are unrolled
+        int64_t cycles = 0;
+        uint8_t a = 0x80;
+        uint8_t b = 0;
+        uint8_t c = 0;
+        bool carry = false;
+        bool zero = false;
+
+        // add a,a
+        auto addA = [&]
+        {
+            carry = (a & 0x80) != 0;
+            a = static_cast<uint8_t>(a << 1);
+            zero = a == 0;
+            cycles += 4;
+        };
+        // ld a,(hl); inc hl; rla, where the carry is the marker bit
+        auto reload = [&]
+        {
+            const auto value = data.next();
+            carry = (value & 0x80) != 0;
+            a = static_cast<uint8_t>((value << 1) | 1);
+            cycles += 7 + 6 + 4;
+        };
+        // add a,a; jr z,_getBitstream_...; where the reload jumps back afterwards
+        auto readBit = [&]
+        {
+            addA();
+            if (zero)
+            {
+                cycles += 12;
+                reload();
+                cycles += 10;
+            }
+            else
+            {
+                cycles += 7;
+            }
+            return carry;
+        };
+        // rl r
+        auto rotateLeft = [&](uint8_t& r)
+        {
+            const bool carryIn = carry;
+            carry = (r & 0x80) != 0;
+            r = static_cast<uint8_t>((r << 1) | (carryIn ? 1 : 0));
+            zero = r == 0;
+            cycles += 8;
+        };
+        // add a,a; jr z,_getBitstream_bitN; jr nc; or the reload then jr c. Returns the bit.
+        auto readBranchBit = [&]
+        {
+            addA();
+            if (zero)
+            {
+                cycles += 12;
+                reload();
+                cycles += carry ? 12 : 7;
+            }
+            else
+            {
+                cycles += carry ? 7 + 7 : 7 + 12;
+            }
+            return carry;
+        };
+        // _getVariableLengthNumber, from after the call to its ret
+        auto readGamma = [&]
+        {
+            // ld bc,1; then each bit with rl c, followed by a flag bit and ret nc. The first two are unrolled, and the
+            // loop after them also does rl b.
+            b = 0;
+            c = 1;
+            cycles += 10;
+            for (int i = 0;; ++i)
+            {
+                readBit();
+                rotateLeft(c);
+                if (i < 2)
+                {
+                    readBit();
+                }
+                else
+                {
+                    // rl b; add a,a; jr z,_getBitstream_variableLengthNumber_bitflag, which does the ret nc itself
+                    rotateLeft(b);
+                    addA();
+                    if (zero)
+                    {
+                        cycles += 12;
+                        reload();
+                    }
+                    else
+                    {
+                        cycles += 7;
+                    }
+                }
+                if (!carry)
+                {
+                    cycles += 11;
+                    return static_cast<uint32_t>((b << 8) | c);
+                }
+                // ret nc not taken, and jp _getVariableLengthNumberloop in the loop
+                cycles += i < 2 ? 5 : 5 + 10;
+            }
+        };
+        // call _ldir_vram_to_vram, which copies bc bytes and leaves b = 0
+        auto vramToVram = [&](const uint32_t count)
+        {
+            // call _ldir_vram_to_vram; ex af,af'; res 6,h; ld a,b; or a; jr z,_below256
+            cycles += 17 + 4 + 8 + 4 + 4;
+            // Each byte: out (c),l; out (c),h; in a,($be); out (c),e; out (c),d; out ($be),a; inc hl; inc de; djnz -
+            constexpr int perByte = 95;
+            const auto low = count & 0xff;
+            bool below256 = true;
+            if (count > 0xff)
+            {
+                // Not taken; push bc; ld b,0; ld c,$bf; call +; 256 bytes; ret; pop bc; djnz - for each 256;
+                // ld a,c; or a; jr z,_done
+                cycles += 7 + (count >> 8) * (11 + 7 + 7 + 17 + 256 * perByte - 5 + 10 + 10 + 13) - 5 + 4 + 4;
+                below256 = low != 0;
+                cycles += below256 ? 7 : 12;
+            }
+            else
+            {
+                cycles += 12;
+            }
+            if (below256)
+            {
+                // ld b,c; ld c,$bf; call +; the bytes; ret
+                cycles += 4 + 7 + 17 + low * perByte - 5 + 10;
+            }
+            // _done: ex af,af'; ret
+            cycles += 4 + 10;
+            b = 0;
+        };
+
+        enum class State
+        {
+            EmitRawByte,
+            MainLoopNoPair,
+            MainLoop,
+            Bit1Set,
+            Bit2Set,
+            EmitSingleByte,
+            EmitSmallBlock,
+            EmitBlock
+        };
+
+        // Set the VRAM address; ld a,%10000000
+        cycles += 7 + 12 + 12 + 7;
+        // ixh is 1 after a literal, when a block can't use the previous offset
+        bool afterLiteral = false;
+        auto state = State::EmitRawByte;
+        for (;;)
+        {
+            switch (state)
+            {
+            case State::EmitRawByte:
+                // push af; ld a,(hl); out ($be),a; pop af; inc hl; inc de
+                data.next();
+                cycles += 11 + 7 + 11 + 10 + 6 + 6;
+                state = State::MainLoopNoPair;
+                break;
+            case State::MainLoopNoPair:
+                // ld ixh,1
+                afterLiteral = true;
+                cycles += 11;
+                state = State::MainLoop;
+                break;
+            case State::MainLoop:
+                // add a,a; jr z,_getBitstream_bit1; jr nc,_emitRawByte; where the reload does jr c, then jp
+                addA();
+                if (zero)
+                {
+                    cycles += 12;
+                    reload();
+                    cycles += carry ? 12 : 7 + 10;
+                }
+                else
+                {
+                    cycles += carry ? 7 + 7 : 7 + 12;
+                }
+                state = carry ? State::Bit1Set : State::EmitRawByte;
+                break;
+            case State::Bit1Set:
+                state = readBranchBit() ? State::Bit2Set : State::EmitBlock;
+                break;
+            case State::Bit2Set:
+                state = readBranchBit() ? State::EmitSingleByte : State::EmitSmallBlock;
+                break;
+            case State::EmitSingleByte:
+                // ld bc,1<<4; then four bits with rl c; jp nc,-
+                b = 0;
+                c = 1 << 4;
+                cycles += 10;
+                do
+                {
+                    readBit();
+                    rotateLeft(c);
+                    cycles += 10;
+                }
+                while (!carry);
+                // jr nz,_emitSingleByte_offset
+                if (c != 0)
+                {
+                    // Taken; read the byte at the offset and write it
+                    cycles += 12 + 4 + 4 + 11 + 15 + 8 + 7 + 12 + 12 + 11 + 10 + 12 + 12 + 11 + 4 + 4 + 6 + 10;
+                }
+                else
+                {
+                    // Not taken; ex de,hl; ld c,$be; out (c),b; ex de,hl; inc de; jp _mainLoop_noPair
+                    cycles += 7 + 4 + 7 + 12 + 4 + 6 + 10;
+                }
+                state = State::MainLoopNoPair;
+                break;
+            case State::EmitSmallBlock:
+            {
+                // ld c,(hl); inc hl; ex af,af'; rr c; ret z. The carry in f' is always 0 here.
+                const auto value = data.next();
+                cycles += 7 + 6 + 4 + 8;
+                if (value >> 1 == 0)
+                {
+                    return cycles + 11;
+                }
+                // ld a,2; ld b,0; adc a,b; push hl; ld iyh,b; ld iyl,c; ld h,d; ld l,e; sbc hl,bc; ld c,a;
+                // ex af,af'; the copy; pop hl; ld ixh,b; jp _mainLoop
+                cycles += 5 + 7 + 7 + 4 + 11 + 8 + 8 + 4 + 4 + 15 + 4 + 4;
+                vramToVram(2u + (value & 1));
+                cycles += 10 + 8 + 10;
+                afterLiteral = false;
+                state = State::MainLoop;
+                break;
+            }
+            case State::EmitBlock:
+            {
+                // call _getVariableLengthNumber; dec c; ex af,af'; ld a,c; sub a,ixh; jr z,_emitBlock_lastOffset
+                cycles += 17;
+                const auto high = readGamma();
+                cycles += 4 + 4 + 4 + 8;
+                uint32_t count;
+                if (static_cast<uint8_t>(high - 1 - (afterLiteral ? 1 : 0)) == 0)
+                {
+                    // Taken; call _getVariableLengthNumber_fromShadowA; push hl; push de; ex de,hl; ld d,iyh;
+                    // ld e,iyl; sbc hl,de; pop de
+                    cycles += 12 + 17 + 4;
+                    count = readGamma();
+                    cycles += 11 + 11 + 4 + 8 + 8 + 15 + 10;
+                }
+                else
+                {
+                    // Not taken; dec a; ld b,a; ld c,(hl); inc hl; ld iyh,b; ld iyl,c; push bc;
+                    // call _getVariableLengthNumber_fromShadowA
+                    const auto offset = static_cast<uint8_t>(high - 2 - (afterLiteral ? 1 : 0)) << 8 | data.next();
+                    cycles += 7 + 4 + 4 + 7 + 6 + 8 + 8 + 11 + 17 + 4;
+                    count = readGamma();
+                    // ex (sp),hl; push de; ex de,hl; ex af,af'; ld hl,127; sbc hl,de; jr c,+
+                    cycles += 19 + 11 + 4 + 4 + 10 + 15;
+                    if (offset <= 127)
+                    {
+                        // Not taken; inc bc; inc bc; jp ++
+                        count += 2;
+                        cycles += 7 + 6 + 6 + 10;
+                    }
+                    else
+                    {
+                        // Taken; ld a,4; cp d; jr nc,++; inc bc; or a
+                        cycles += 12 + 7 + 4;
+                        if (offset >> 8 >= 5)
+                        {
+                            ++count;
+                            cycles += 7 + 6 + 4;
+                        }
+                        else
+                        {
+                            cycles += 12;
+                        }
+                    }
+                    // ++: pop hl; push hl; sbc hl,de; ex af,af'; pop de
+                    cycles += 10 + 11 + 15 + 4 + 10;
+                }
+                // The copy; pop hl; ld ixh,b; jp _mainLoop
+                vramToVram(count);
+                cycles += 10 + 8 + 10;
+                afterLiteral = false;
+                state = State::MainLoop;
+                break;
+            }
+            }
+        }
+    }
+
+    using Estimator = std::function<int64_t(Reader&)>;
+
+    // Keyed by the plugin extension
+    const std::unordered_map<std::string, Estimator>& getEstimators()
+    {
+        static const std::unordered_map<std::string, Estimator> estimators
+        {
+            {"aleste", aleste},
+            {"soniccompr", sonic1},
+            {"sonic2compr", sonic2},
+            {"psgcompr", phantasyStarGaiden},
+            {"mmcompr", microMachines},
+            {"mmcomprfast", microMachines},
+            {"zx7", zx7},
+            {"sfg", shiningForceGaiden},
+            {"lz4", lz4},
+            {"zx0", zx0},
+            {"lzsa1", lzsa1},
+            {"lzsa2", lzsa2},
+            {"aPLib", aPLib},
+            {"apultra", aPLib},
+        };
+        return estimators;
+    }
+}
+
+int64_t Z80Cycles::estimate(const std::string& format, const uint8_t* pData, const uint32_t length)
+{
+    const auto& estimators = getEstimators();
+    const auto it = estimators.find(format);
+    if (it == estimators.end())
+    {
+        return -1;
+    }
+    try
+    {
+        Reader reader(pData, length);
+        return callCycles + it->second(reader) + returnCycles;
+    }
+    catch (const std::exception&)
+    {
+        return -1;
+    }
+}
+
+bool Z80Cycles::isSupported(const std::string& format)
+{
+    return getEstimators().contains(format);
+}
+
+double Z80Cycles::toMicroseconds(const int64_t cycles)
+{
+    // The NTSC Master System runs at 3579545Hz
+    return static_cast<double>(cycles) / 3.579545;
+}
+
+double Z80Cycles::tilesPerFrame(const int64_t cycles, const uint32_t uncompressedLength)
+{
+    // One frame is 262 lines of 228 cycles each, and a tile is 32 bytes
+    const auto frames = static_cast<double>(cycles) / (228 * 262);
+    return uncompressedLength / 32.0 / frames;
+}
@@ -0,0 +1,24 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+// Estimates how long the Z80 decompressors in decompressors/ take to decompress some data to VRAM, without needing to
+// assemble and run them. We walk the compressed data as the decompressor would and add up the cycles each part of it
+// costs, as counted from the decompressor code. The results include calling the decompressor with hl and de set up, as
+// the benchmark does, so they can be compared with benchmark-results.json.
+class Z80Cycles
+{
+public:
+    // Returns the number of cycles to decompress the data, or -1 if we don't know the format or the data is not valid.
+    // format is the extension of the plugin which made it.
+    static int64_t estimate(const std::string& format, const uint8_t* pData, uint32_t length);
+
+    // Whether we can estimate the given format
+    static bool isSupported(const std::string& format);
+
+    // The time taken on an NTSC Master System
+    static double toMicroseconds(int64_t cycles);
+
+    // How many tiles could be decompressed in one frame at this speed
+    static double tilesPerFrame(int64_t cycles, uint32_t uncompressedLength);
+};
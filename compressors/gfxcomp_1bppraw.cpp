@@ -1,5 +1,6 @@
 #include <cstdint>
 
+#include "CompressTilesBatch.h"
 #include "utils.h"
 
 extern "C" __declspec(dllexport) const char* getName()
@@ -15,6 +16,19 @@ extern "C" __declspec(dllexport) const char* getExt()
     return "1bpp";
 }
 
+// We keep one bitplane in four. We can't do tilemaps.
+extern "C" __declspec(dllexport) uint32_t getMaxCompressedSize(
+    const uint32_t uncompressedBytes,
+    const bool isTilemap)
+{
+    return isTilemap ? 0 : uncompressedBytes / 4;
+}
+
+extern "C" __declspec(dllexport) int32_t getThreadSafety()
+{
+    return ThreadSafety::Reentrant;
+}
+
 extern "C" __declspec(dllexport) int32_t compressTiles(
     const uint8_t* pSource,
     const uint32_t numTiles,
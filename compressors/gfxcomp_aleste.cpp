@@ -1,8 +1,11 @@
 #include <algorithm>
+#include <array>
 #include <cstdint>
-#include <iterator>
 #include <stdexcept>
 
+#include "CompressTilesBatch.h"
+#include "OptimalParser.h"
+#include "OutputSink.h"
 #include "utils.h"
 
 extern "C" __declspec(dllexport) const char* getName()
@@ -18,146 +21,188 @@ extern "C" __declspec(dllexport) const char* getExt()
     return "aleste";
 }
 
+// The optimal parse is never bigger than raw runs of 127 bytes, which cost one byte each, plus the terminator.
+// This is for compressTiles() and compressTilemap(); weighting for decompression speed may give bigger data.
+extern "C" __declspec(dllexport) uint32_t getMaxCompressedSize(
+    const uint32_t uncompressedBytes,
+    const bool /*isTilemap*/)
+{
+    return uncompressedBytes + (uncompressedBytes + 126) / 127 + 1;
+}
+
+extern "C" __declspec(dllexport) int32_t getThreadSafety()
+{
+    return ThreadSafety::Reentrant;
+}
+
 namespace
 {
-    struct Match
+    struct Format
     {
-        enum class Modes: uint8_t
+        enum class Token: uint8_t
         {
-            Default,
-            Lz,
-            Raw
+            None,
+            Lz,     // %1nnnnnnn $oo    Copy n+3 bytes from offset -(o+1)
+            Raw     // %0nnnnnnn        Copy n bytes from the data
         };
 
-        explicit Match(const Modes mode) :
-            mode(mode),
-            offset(-1),
-            costToEnd(std::numeric_limits<int>::max()),
-            length(-1),
-            lzOffset(-1)
+        using Cost = int64_t;
+    };
+
+    // Tracks the match length at every LZ offset as we work backwards through the data. Each position's lengths are
+    // one comparison from those of the position after it, so this is O(n * 256) in total.
+    class OffsetMatcher
+    {
+    public:
+        static constexpr int minLength = 3;
+        static constexpr int maxLength = 130;
+        static constexpr int maxOffset = 256;
+
+        explicit OffsetMatcher(const std::vector<uint8_t>& data):
+            _data(data),
+            _lengths(data.size() + 1, 0)
         {
         }
 
-        // Match type
-        Modes mode;
-        // Location in data
-        int offset;
-        // Encoding cost to end of data
-        int costToEnd;
-        // Length
-        int length;
-        // LZ offset
-        int lzOffset;
-
-        int writeTo(std::vector<uint8_t>& vector, const std::vector<uint8_t>& data) const
+        // Moves to position, which must be one before the previous position (or the last byte, to start).
+        // Fills nearestOffset[length] with the smallest offset matching that many bytes, and returns the longest
+        // length matched, or 0 if there is none.
+        int moveTo(const int position, std::array<int, maxLength + 1>& nearestOffset)
         {
-            switch (mode)
+            // The match from source at this position extends the one from source + 1 at the next position. Working
+            // forwards means we read each old value before overwriting it, and the compiler can vectorize this (so we
+            // use raw pointers to avoid reloading them after every byte store).
+            // Matches may overlap the position, and are capped at the longest we can encode.
+            const int firstSource = std::max(0, position - maxOffset);
+            const uint8_t value = _data[position];
+            const uint8_t* data = _data.data();
+            uint8_t* lengths = _lengths.data();
+            for (int source = firstSource; source < position; ++source)
             {
-            case Modes::Lz:
-                vector.push_back(static_cast<uint8_t>(0b10000000 | (length - 3)));
-                vector.push_back(static_cast<uint8_t>(lzOffset - 1));
-                return length;
-            case Modes::Raw:
-                vector.push_back(static_cast<uint8_t>(length));
-                std::ranges::copy_n(data.begin() + offset, length, std::back_inserter(vector));
-                return length;
-            case Modes::Default:
-                throw std::runtime_error("Unexpected mode=default");
+                const uint8_t length = lengths[source + 1];
+                lengths[source] = data[source] == value ? static_cast<uint8_t>(length + (length < maxLength)) : 0;
             }
-            throw std::runtime_error("Unexpected mode=default");
+
+            int longest = 0;
+            for (int source = position - 1; source >= firstSource && longest < maxLength; --source)
+            {
+                // Every length up to the longest seen so far already has a nearer offset
+                for (int length = longest + 1; length <= lengths[source]; ++length)
+                {
+                    nearestOffset[length] = position - source;
+                }
+                longest = std::max(longest, static_cast<int>(lengths[source]));
+            }
+            return longest < minLength ? 0 : longest;
         }
+
+    private:
+        const std::vector<uint8_t>& _data;
+        // Match length from each source position to the current position
+        std::vector<uint8_t> _lengths;
+    };
+
+    // Approximate Z80 cycles taken by aleste_decompressor.asm to process each kind of match, including the dispatch
+    struct Cycles
+    {
+        int fixed;
+        int perByte;
     };
 
+    constexpr Cycles lzCycles{.fixed = 199, .perByte = 56};
+    constexpr Cycles rawCycles{.fixed = 147, .perByte = 58};
+
+    // Combines the compressed size and decompression time into a single cost to minimise.
+    // By default we count only bytes; giving cycles a weight trades size for speed.
+    struct CostModel
+    {
+        int64_t byteWeight;
+        int64_t cycleWeight;
+
+        [[nodiscard]]
+        int64_t cost(const int bytes, const Cycles& cycles, const int byteCount) const
+        {
+            return bytes * byteWeight + (cycles.fixed + cycles.perByte * byteCount) * cycleWeight;
+        }
+    };
+
+    // We count only the compressed size by default
+    constexpr CostModel sizeCostModel{.byteWeight = 1, .cycleWeight = 0};
+
     int32_t compress(
+        Context& context,
         const uint8_t* pSource,
         const size_t sourceLength,
         uint8_t* pDestination,
-        const size_t destinationLength)
+        const size_t destinationLength,
+        const CostModel& costModel)
     {
-        auto data = Utils::toVector(pSource, sourceLength);
-
-        // Best matches found so far
-        std::vector bestMatches(data.size(), Match(Match::Modes::Default));
+        const auto& data = Utils::toVector(context, pSource, sourceLength);
 
         auto lenData = static_cast<int>(data.size());
 
+        auto& parser = context.get<OptimalParser<Format>>();
+        parser.reset(data.size());
+
+        OffsetMatcher matcher(data);
+        std::array<int, OffsetMatcher::maxLength + 1> nearestOffset{};
+
+        // Raw runs cost n+1 bytes for n = 1..127
+        OptimalParser<Format>::RunFinder rawRunFinder(
+            Format::Token::Raw,
+            1,
+            127,
+            costModel.cost(1, rawCycles, 0),
+            costModel.cost(1, {0, rawCycles.perByte}, 1));
+
         // Work through the file backwards
         for (int position = lenData - 1; position >= 0; --position)
         {
             // Find the best option at this point, that either gets to the end of the file or to a position in the
-            // sequences that sums to the lowest byte length
+            // sequences that sums to the lowest cost
 
             // First, we look for LZ matches.
             // LZ run length is in the range 3..130 but also bounded by the number of bytes to the left and right
-            for (int length = 3; length < std::min(lenData - position, 130) + 1; ++length)
+            const int longest = matcher.moveTo(position, nearestOffset);
+            for (int length = OffsetMatcher::minLength; length <= longest; ++length)
             {
-                // Look for a match
-                const auto& r = std::ranges::find_end(
-                    // Haystack
-                    data.begin() + std::max(0, position - 256),
-                    data.begin() + position + length - 1,
-                    // Needle
-                    data.begin() + position,
-                    data.begin() + position + length);
-                if (r.begin() != r.end())
-                {
-                    // We have a match
-                    // LZ matches are always 2 bytes
-                    auto cost = 2;
-                    if (position + length < lenData)
-                    {
-                        cost += bestMatches[position + length].costToEnd;
-                    }
-                    if (cost < bestMatches[position].costToEnd)
-                    {
-                        bestMatches[position].costToEnd = cost;
-                        bestMatches[position].mode = Match::Modes::Lz;
-                        bestMatches[position].length = length;
-                        bestMatches[position].lzOffset = position - std::distance(data.begin(), r.begin());
-                    }
-                }
-                else
-                {
-                    // We try short lengths because they might have a cheaper total cost, but if we failed to find any 
-                    // match at length n, length n+1 will fail too
-                    break;
-                }
+                // LZ matches are always 2 bytes
+                parser.offer(
+                    position,
+                    Format::Token::Lz,
+                    length,
+                    nearestOffset[length],
+                    costModel.cost(2, lzCycles, length) + parser.costToEnd(position + length));
             }
 
             // Finally raw matches...
-            for (int n = 1; n < std::min(127, lenData - position) + 1; ++n)
-            {
-                // A raw match will cost n+1 bytes
-                int cost = n + 1;
-                if (position + n < lenData)
-                {
-                    cost += bestMatches[position + n].costToEnd;
-                }
-                if (cost < bestMatches[position].costToEnd)
-                {
-                    bestMatches[position].costToEnd = cost;
-                    bestMatches[position].mode = Match::Modes::Raw;
-                    bestMatches[position].length = n;
-                    bestMatches[position].offset = position;
-                }
-            }
+            rawRunFinder.tryAt(position, parser);
         }
 
-        // Now we have filled our vector, and we can walk through the matches to populate our data.
-        // First two bytes are the compressed data length, which is the same as the first cost.
-        std::vector<uint8_t> result;
-
-        auto position = 0;
-        while (position < lenData)
+        // Now we have filled our vector, and we can walk through the matches to write our data.
+        OutputSink sink(pDestination, destinationLength);
+        parser.trace([&](const int position, const Format::Token token, const int length, const int lzOffset)
         {
-            const auto& match = bestMatches[position];
-            position += match.writeTo(result, data);
-        }
+            switch (token)
+            {
+            case Format::Token::Lz:
+                sink.addByte(static_cast<uint8_t>(0b10000000 | (length - 3)));
+                sink.addByte(static_cast<uint8_t>(lzOffset - 1));
+                break;
+            case Format::Token::Raw:
+                sink.addByte(static_cast<uint8_t>(length));
+                sink.addBytes(data, position, length);
+                break;
+            case Format::Token::None:
+                throw std::runtime_error("Unexpected token");
+            }
+            // Stop once it can't fit
+            return !sink.isFull();
+        });
 
-        result.push_back(0); // Terminator
+        sink.addByte(0); // Terminator
 
-        // Copy to the destination buffer if it fits
-        return Utils::copyToDestination(result, pDestination, destinationLength);
+        return sink.result();
     }
 }
 
@@ -168,7 +213,8 @@ extern "C" __declspec(dllexport) int32_t compressTiles(
     const uint32_t destinationLength)
 {
     // Compress tiles
-    return compress(pSource, numTiles * 32, pDestination, destinationLength);
+    Context context;
+    return compress(context, pSource, numTiles * 32, pDestination, destinationLength, sizeCostModel);
 }
 
 extern "C" __declspec(dllexport) int32_t compressTilemap(
@@ -179,5 +225,54 @@ extern "C" __declspec(dllexport) int32_t compressTilemap(
     const uint32_t destinationLength)
 {
     // Compress tilemap
-    return compress(pSource, width * height * 2, pDestination, destinationLength);
+    Context context;
+    return compress(context, pSource, width * height * 2, pDestination, destinationLength, sizeCostModel);
+}
+
+// As compressTiles, but reusing memory from a context made by createContext()
+extern "C" __declspec(dllexport) int32_t compressTilesEx(
+    Context* pContext,
+    const uint8_t* pSource,
+    const uint32_t numTiles,
+    uint8_t* pDestination,
+    const uint32_t destinationLength)
+{
+    return compress(*pContext, pSource, numTiles * 32, pDestination, destinationLength, sizeCostModel);
+}
+
+// As compressTilemap, but reusing memory from a context made by createContext()
+extern "C" __declspec(dllexport) int32_t compressTilemapEx(
+    Context* pContext,
+    const uint8_t* pSource,
+    const uint32_t width,
+    const uint32_t height,
+    uint8_t* pDestination,
+    const uint32_t destinationLength)
+{
+    return compress(*pContext, pSource, width * height * 2, pDestination, destinationLength, sizeCostModel);
+}
+
+// These variants trade compressed size against decompression speed. cyclesPerByte says how many Z80 cycles
+// of decompression time we would spend to save one byte of compressed data; 0 means to optimise only for speed.
+extern "C" __declspec(dllexport) int32_t compressTilesWithCycleWeight(
+    const uint8_t* pSource,
+    const uint32_t numTiles,
+    uint8_t* pDestination,
+    const uint32_t destinationLength,
+    const uint32_t cyclesPerByte)
+{
+    Context context;
+    return compress(context, pSource, numTiles * 32, pDestination, destinationLength, {cyclesPerByte, 1});
+}
+
+extern "C" __declspec(dllexport) int32_t compressTilemapWithCycleWeight(
+    const uint8_t* pSource,
+    const uint32_t width,
+    const uint32_t height,
+    uint8_t* pDestination,
+    const uint32_t destinationLength,
+    const uint32_t cyclesPerByte)
+{
+    Context context;
+    return compress(context, pSource, width * height * 2, pDestination, destinationLength, {cyclesPerByte, 1});
 }
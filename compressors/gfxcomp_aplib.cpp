@@ -1,6 +1,7 @@
 #include <cstdint>
 #include <algorithm>
 
+#include "CompressTilesBatch.h"
 #include "utils.h"
 #include "aPLib/aplib.h"
 
@@ -45,6 +46,19 @@ extern "C" __declspec(dllexport) const char* getExt()
     return "aPLib";
 }
 
+// aPLib tells us
+extern "C" __declspec(dllexport) uint32_t getMaxCompressedSize(
+    const uint32_t uncompressedBytes,
+    const bool /*isTilemap*/)
+{
+    return static_cast<uint32_t>(aP_max_packed_size(uncompressedBytes));
+}
+
+extern "C" __declspec(dllexport) int32_t getThreadSafety()
+{
+    return ThreadSafety::Reentrant;
+}
+
 extern "C" __declspec(dllexport) int32_t compressTiles(
     const uint8_t* pSource,
     const uint32_t numTiles,
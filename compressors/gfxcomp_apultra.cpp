@@ -1,5 +1,6 @@
 #include <cstdint>
 
+#include "CompressTilesBatch.h"
 #include "libapultra.h"
 #include "utils.h"
 
@@ -35,6 +36,19 @@ extern "C" __declspec(dllexport) const char* getExt()
     return "apultra";
 }
 
+// apultra tells us
+extern "C" __declspec(dllexport) uint32_t getMaxCompressedSize(
+    const uint32_t uncompressedBytes,
+    const bool /*isTilemap*/)
+{
+    return static_cast<uint32_t>(apultra_get_max_compressed_size(uncompressedBytes));
+}
+
+extern "C" __declspec(dllexport) int32_t getThreadSafety()
+{
+    return ThreadSafety::Reentrant;
+}
+
 extern "C" __declspec(dllexport) int32_t compressTiles(
     const uint8_t* pSource,
     const uint32_t numTiles,
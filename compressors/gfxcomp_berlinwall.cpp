@@ -3,6 +3,8 @@
 #include <vector>
 #include <ranges>
 
+#include "CompressTilesBatch.h"
+#include "OutputSink.h"
 #include "utils.h"
 
 extern "C" __declspec(dllexport) const char* getName()
@@ -18,26 +20,42 @@ extern "C" __declspec(dllexport) const char* getExt()
     return "berlinwallcompr";
 }
 
+// At worst, every byte is raw at 9 bits each, after a 16 bit header
+extern "C" __declspec(dllexport) uint32_t getMaxCompressedSize(
+    const uint32_t uncompressedBytes,
+    const bool /*isTilemap*/)
+{
+    return 2 + (uncompressedBytes * 9 + 7) / 8;
+}
+
+extern "C" __declspec(dllexport) int32_t getThreadSafety()
+{
+    return ThreadSafety::Reentrant;
+}
+
 class Bitstream
 {
-    std::vector<uint8_t> _buffer;
-    int _bitCount = 8;
+    OutputSink& _sink;
+    uint8_t _currentByte = 0;
+    int _bitCount = 0;
 
 public:
+    explicit Bitstream(OutputSink& sink): _sink(sink)
+    {
+    }
+
     void addBit(const unsigned int bit)
     {
-        // If we have run out of space then emit a new byte to work on
+        // Shift into the current byte
+        _currentByte = static_cast<uint8_t>((_currentByte << 1) | bit);
+        ++_bitCount;
+        // And emit it once it is complete
         if (_bitCount == 8)
         {
-            _buffer.push_back(0);
+            _sink.addByte(_currentByte);
+            _currentByte = 0;
             _bitCount = 0;
         }
-        // Or into the end of the current byte
-        auto b = _buffer[_buffer.size() - 1];
-        b <<= 1;
-        b |= bit;
-        _buffer[_buffer.size() - 1] = b;
-        ++_bitCount;
     }
 
     void addBits(const unsigned int value, const unsigned int bitCount)
@@ -52,16 +70,11 @@ public:
     void finalize()
     {
         // We want to flush the current byte in progress so it's left-aligned
-        while(_bitCount != 8)
+        while (_bitCount != 0)
         {
             addBit(0);
         }
     }
-
-    const std::vector<uint8_t>& getBuffer()
-    {
-        return _buffer;
-    }
 };
 
 // The actual compressor function
@@ -72,13 +85,15 @@ int32_t compress(
     const size_t destinationLength)
 {
     const auto source = Utils::toVector(pSource, sourceLength);
-    Bitstream result;
+    OutputSink sink(pDestination, destinationLength);
+    Bitstream result(sink);
 
     // We amend the original format by prefixing it with the length in bytes, divided by 16.
     // The original expects the caller to know what this is.
     result.addBits(sourceLength / 16, 16);
 
-    for (auto offset = 0; offset < static_cast<int>(source.size());) // increment in loop
+    // We stop early if it doesn't fit
+    for (auto offset = 0; offset < static_cast<int>(source.size()) && !sink.isFull();) // increment in loop
     {
         // Look for the longest run in data before the current offset which matches the current data
         auto bestLzOffset = -1;
@@ -141,7 +156,7 @@ int32_t compress(
 
     result.finalize();
 
-    return Utils::copyToDestination(result.getBuffer(), pDestination, destinationLength);
+    return sink.result();
 }
 
 extern "C" __declspec(dllexport) int32_t compressTiles(
@@ -0,0 +1,431 @@
+// This plugin runs a set of other compressor plugins on each input and returns the smallest result.
+// Like gfxcomp_exe, it looks at its own filename and uses that to find a config file, which looks like this:
+//
+// [Settings]
+// Name=Best of aPLib, ZX7 and LZ4
+// Plugins=apultra,zx7,lz4
+// Tag=1
+// Threads=0
+// MaxCyclesPerByte=0
+//
+// [CyclesPerByte]
+// apultra=183.7
+// zx7=147.6
+// lz4=93.9
+//
+// Plugins lists the DLL names (without the gfxcomp_ prefix) of plugins in the same directory as this one. The output
+// starts with a byte holding the index in this list of the one that won, so a decompressor can dispatch on it; Tag=0
+// leaves this out. The plugins are run concurrently on up to Threads threads, where 0 means one per CPU core.
+// If MaxCyclesPerByte is not 0, we only use plugins whose decompression speed in the [CyclesPerByte] section, keyed by
+// their extension, is no more than that, and skip any without one. "benchmark.py speeds" makes that section from
+// benchmark-results.json. For tiles in formats Z80Cycles can estimate, we instead check the cycles per byte of each
+// result, so a plugin can still win on data it happens to decompress quickly.
+
+#pragma warning(push,3)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "CompressTilesBatch.h"
+#include "utils.h"
+#include "Z80Cycles.h"
+#pragma warning(pop)
+
+HINSTANCE g_hInstance;
+
+extern "C" BOOL APIENTRY DllMain(HINSTANCE hInst, DWORD, LPVOID)
+{
+    g_hInstance = hInst;
+    return TRUE;
+}
+
+namespace
+{
+    std::filesystem::path getModuleFilename()
+    {
+        std::vector<char> buffer(256);
+        // This returns the buffer size if it was truncated
+        while (GetModuleFileName(g_hInstance, buffer.data(), static_cast<DWORD>(buffer.size())) == buffer.size())
+        {
+            buffer.resize(buffer.size() * 2);
+        }
+        return buffer.data();
+    }
+
+    const std::string& getConfigFilename()
+    {
+        static const std::string filename = getModuleFilename().string() + ".ini";
+        return filename;
+    }
+
+    std::string getSetting(const char* section, const std::string& name)
+    {
+        const auto& configFilename = getConfigFilename();
+        std::vector<char> buffer(256);
+        // This returns the number of chars copied (not including the null terminator), so if it tells us
+        // bufferSize - 1 then it may be truncated and we retry with a bigger buffer.
+        while (GetPrivateProfileString(
+            section,
+            name.c_str(),
+            "",
+            buffer.data(),
+            static_cast<DWORD>(buffer.size()),
+            configFilename.c_str()) == buffer.size() - 1)
+        {
+            buffer.resize(buffer.size() * 2);
+        }
+        return buffer.data();
+    }
+
+    int getSettingInt(const std::string& name, const int defaultValue)
+    {
+        return static_cast<int>(
+            GetPrivateProfileInt("Settings", name.c_str(), defaultValue, getConfigFilename().c_str()));
+    }
+
+    struct Plugin
+    {
+        using CompressTiles = int32_t(*)(const uint8_t*, uint32_t, uint8_t*, uint32_t);
+        using CompressTilemap = int32_t(*)(const uint8_t*, uint32_t, uint32_t, uint8_t*, uint32_t);
+        using GetMaxCompressedSize = uint32_t(*)(uint32_t, bool);
+        using GetThreadSafety = int32_t(*)();
+
+        std::string name;
+        std::string extension;
+        // Its index in the Plugins setting
+        uint8_t tag;
+        CompressTiles compressTiles;
+        CompressTilemap compressTilemap;
+        GetMaxCompressedSize getMaxCompressedSize;
+        // From the [CyclesPerByte] section, or 0 if not there
+        double cyclesPerByte;
+        // Held while calling plugins which can't handle overlapping calls
+        std::unique_ptr<std::mutex> mutex;
+    };
+
+    struct Config
+    {
+        std::string pluginNames;
+        std::vector<Plugin> plugins;
+        bool tag;
+        unsigned int threads;
+        int maxCyclesPerByte;
+    };
+
+    Config loadConfig()
+    {
+        Config config;
+        config.pluginNames = getSetting("Settings", "Plugins");
+        config.tag = getSettingInt("Tag", 1) != 0;
+        config.threads = static_cast<unsigned int>(getSettingInt("Threads", 0));
+        if (config.threads == 0)
+        {
+            config.threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+        config.maxCyclesPerByte = getSettingInt("MaxCyclesPerByte", 0);
+        const auto moduleFilename = getModuleFilename();
+        const auto directory = moduleFilename.parent_path();
+
+        std::istringstream names(config.pluginNames);
+        std::string name;
+        for (int index = 0; std::getline(names, name, ','); ++index)
+        {
+            std::erase(name, ' ');
+            if ("gfxcomp_" + name == moduleFilename.stem().string())
+            {
+                // Don't load ourselves
+                continue;
+            }
+            if (index > 255)
+            {
+                printf("Too many plugins, ignoring %s\n", name.c_str());
+                continue;
+            }
+            const auto filename = directory / ("gfxcomp_" + name + ".dll");
+            const HMODULE hModule = LoadLibrary(filename.string().c_str());
+            if (hModule == nullptr)
+            {
+                printf("Failed to load %s\n", filename.string().c_str());
+                continue;
+            }
+            const auto getExt = reinterpret_cast<const char*(*)()>(GetProcAddress(hModule, "getExt"));
+            const std::string extension = getExt == nullptr ? "" : getExt();
+            const auto cyclesPerByte = std::strtod(getSetting("CyclesPerByte", extension).c_str(), nullptr);
+            if (config.maxCyclesPerByte > 0
+                && !Z80Cycles::isSupported(extension)
+                && (cyclesPerByte <= 0 || cyclesPerByte > config.maxCyclesPerByte))
+            {
+                printf("Skipping %s as it is not known to be fast enough\n", name.c_str());
+                FreeLibrary(hModule);
+                continue;
+            }
+            const auto getThreadSafety = reinterpret_cast<Plugin::GetThreadSafety>(
+                GetProcAddress(hModule, "getThreadSafety"));
+            config.plugins.push_back({
+                .name = name,
+                .extension = extension,
+                .tag = static_cast<uint8_t>(index),
+                .compressTiles = reinterpret_cast<Plugin::CompressTiles>(GetProcAddress(hModule, "compressTiles")),
+                .compressTilemap = reinterpret_cast<Plugin::CompressTilemap>(
+                    GetProcAddress(hModule, "compressTilemap")),
+                .getMaxCompressedSize = reinterpret_cast<Plugin::GetMaxCompressedSize>(
+                    GetProcAddress(hModule, "getMaxCompressedSize")),
+                .cyclesPerByte = cyclesPerByte,
+                .mutex = getThreadSafety != nullptr && getThreadSafety() != ThreadSafety::None
+                    ? nullptr
+                    : std::make_unique<std::mutex>()
+            });
+        }
+        return config;
+    }
+
+    const Config& getConfig()
+    {
+        static const Config config = loadConfig();
+        return config;
+    }
+
+    // Runs compress(plugin, pDestination, destinationLength) and returns the result. If the plugin can't tell us how
+    // big the result may be, we guess, and grow the destination if it turns out to be too small.
+    template <typename F>
+    std::vector<uint8_t> runPlugin(
+        const Plugin& plugin,
+        const uint32_t sourceLength,
+        const bool isTilemap,
+        F&& compress)
+    {
+        std::unique_lock<std::mutex> lock;
+        if (plugin.mutex)
+        {
+            lock = std::unique_lock(*plugin.mutex);
+        }
+        // Results are returned as int32_t, so there's no point going bigger than that
+        constexpr uint64_t maxCapacity = std::numeric_limits<int32_t>::max();
+        const uint32_t maxCompressedSize = plugin.getMaxCompressedSize == nullptr
+            ? 0
+            : plugin.getMaxCompressedSize(sourceLength, isTilemap);
+        auto capacity = std::min(
+            maxCompressedSize == 0 ? uint64_t{sourceLength} * 2 + 1024 : maxCompressedSize,
+            maxCapacity);
+        for (int attempt = 0; attempt < 4; ++attempt)
+        {
+            std::vector<uint8_t> result(capacity);
+            const auto size = compress(plugin, result.data(), static_cast<uint32_t>(capacity));
+            if (size < 0)
+            {
+                break;
+            }
+            if (size > 0)
+            {
+                result.resize(size);
+                return result;
+            }
+            if (maxCompressedSize != 0 || capacity == maxCapacity)
+            {
+                // A bigger buffer won't help
+                break;
+            }
+            capacity = std::min(capacity * 4, maxCapacity);
+        }
+        return {};
+    }
+
+    // Checks a tile result will decompress fast enough, for plugins we let through in loadConfig() without checking
+    // their cycles per byte
+    bool isFastEnough(
+        const Config& config,
+        const Plugin& plugin,
+        const std::vector<uint8_t>& result,
+        const uint32_t sourceLength)
+    {
+        if (config.maxCyclesPerByte <= 0 || !Z80Cycles::isSupported(plugin.extension))
+        {
+            return true;
+        }
+        const auto cycles = Z80Cycles::estimate(
+            plugin.extension,
+            result.data(),
+            static_cast<uint32_t>(result.size()));
+        if (cycles < 0)
+        {
+            // We can't tell, so we don't use it. This is per result, so we don't log it.
+            return false;
+        }
+        return static_cast<double>(cycles) / sourceLength <= config.maxCyclesPerByte;
+    }
+
+    template <typename F>
+    int32_t compressBest(
+        const uint32_t sourceLength,
+        const bool isTilemap,
+        uint8_t* pDestination,
+        const uint32_t destinationLength,
+        F&& compress)
+    {
+        const auto& config = getConfig();
+        // An empty result means the plugin failed
+        std::vector<std::vector<uint8_t>> results(config.plugins.size());
+        std::atomic_size_t next = 0;
+        auto worker = [&]
+        {
+            for (auto i = next++; i < config.plugins.size(); i = next++)
+            {
+                const auto& plugin = config.plugins[i];
+                if (isTilemap
+                    && config.maxCyclesPerByte > 0
+                    && (plugin.cyclesPerByte <= 0 || plugin.cyclesPerByte > config.maxCyclesPerByte))
+                {
+                    // The estimates are for decompressing tiles to VRAM, so for tilemaps we go by the table
+                    continue;
+                }
+                results[i] = runPlugin(plugin, sourceLength, isTilemap, compress);
+                if (!isTilemap && !results[i].empty() && !isFastEnough(config, plugin, results[i], sourceLength))
+                {
+                    results[i].clear();
+                }
+            }
+        };
+        {
+            std::vector<std::jthread> threads;
+            for (auto i = 1u; i < std::min<std::size_t>(config.threads, config.plugins.size()); ++i)
+            {
+                threads.emplace_back(worker);
+            }
+            worker();
+        }
+
+        // Pick the smallest, preferring earlier ones if equal
+        std::size_t bestIndex = results.size();
+        for (std::size_t i = 0; i < results.size(); ++i)
+        {
+            if (!results[i].empty() && (bestIndex == results.size() || results[i].size() < results[bestIndex].size()))
+            {
+                bestIndex = i;
+            }
+        }
+        if (bestIndex == results.size())
+        {
+            return ReturnValues::CannotCompress;
+        }
+        const auto& best = results[bestIndex];
+        const uint32_t tagSize = config.tag ? 1 : 0;
+        if (best.size() + tagSize > destinationLength)
+        {
+            return ReturnValues::BufferTooSmall;
+        }
+        if (config.tag)
+        {
+            *pDestination = config.plugins[bestIndex].tag;
+        }
+        std::ranges::copy(best, pDestination + tagSize);
+        return static_cast<int32_t>(best.size() + tagSize);
+    }
+}
+
+extern "C" __declspec(dllexport) const char* getName()
+{
+    static std::string name;
+    if (name.empty())
+    {
+        name = getSetting("Settings", "Name");
+        if (name.empty())
+        {
+            name = "Best of " + getConfig().pluginNames;
+        }
+    }
+    return name.c_str();
+}
+
+extern "C" __declspec(dllexport) const char* getExt()
+{
+    // We use our filename, so the DLL can be copied for different sets of plugins
+    static std::string extension;
+    if (extension.empty())
+    {
+        extension = getModuleFilename().stem().string().substr(8);
+    }
+    return extension.c_str();
+}
+
+// The biggest of the plugins', plus the tag, if they all know theirs
+extern "C" __declspec(dllexport) uint32_t getMaxCompressedSize(
+    const uint32_t uncompressedBytes,
+    const bool isTilemap)
+{
+    const auto& config = getConfig();
+    uint32_t result = 0;
+    for (const auto& plugin : config.plugins)
+    {
+        if (isTilemap ? plugin.compressTilemap == nullptr : plugin.compressTiles == nullptr)
+        {
+            // Not used
+            continue;
+        }
+        const auto size = plugin.getMaxCompressedSize == nullptr
+            ? 0
+            : plugin.getMaxCompressedSize(uncompressedBytes, isTilemap);
+        if (size == 0)
+        {
+            return 0;
+        }
+        result = std::max(result, size);
+    }
+    return result == 0 ? 0 : result + (config.tag ? 1 : 0);
+}
+
+// Plugins which need it are serialised by runPlugin()
+extern "C" __declspec(dllexport) int32_t getThreadSafety()
+{
+    return ThreadSafety::Reentrant;
+}
+
+extern "C" __declspec(dllexport) int32_t compressTiles(
+    const uint8_t* pSource,
+    const uint32_t numTiles,
+    uint8_t* pDestination,
+    const uint32_t destinationLength)
+{
+    return compressBest(
+        numTiles * 32,
+        false,
+        pDestination,
+        destinationLength,
+        [&](const Plugin& plugin, uint8_t* pPluginDestination, const uint32_t pluginDestinationLength)
+        {
+            return plugin.compressTiles == nullptr
+                ? ReturnValues::CannotCompress
+                : plugin.compressTiles(pSource, numTiles, pPluginDestination, pluginDestinationLength);
+        });
+}
+
+extern "C" __declspec(dllexport) int32_t compressTilemap(
+    const uint8_t* pSource,
+    const uint32_t width,
+    const uint32_t height,
+    uint8_t* pDestination,
+    const uint32_t destinationLength)
+{
+    return compressBest(
+        width * height * 2,
+        true,
+        pDestination,
+        destinationLength,
+        [&](const Plugin& plugin, uint8_t* pPluginDestination, const uint32_t pluginDestinationLength)
+        {
+            return plugin.compressTilemap == nullptr
+                ? ReturnValues::CannotCompress
+                : plugin.compressTilemap(pSource, width, height, pPluginDestination, pluginDestinationLength);
+        });
+}
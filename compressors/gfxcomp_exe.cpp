@@ -4,24 +4,65 @@
 // [Settings]
 // Name=Some name (for display purposes)
 // Command=program.exe "%input%" "%output%"
+// Workers=1
 //
 // You can put anything in the Command, %input% and %output% will be substituted with filenames
 // (possibly with spaces). Non-zero return codes will be interpreted as an error.
-// TODO: allow stdin/stdout?
+//
+// Alternatively, add Mode=persistent to start the Command once and keep it running. We then send it each piece of data
+// on its stdin, as a 4-byte little-endian length followed by the data, and it replies on its stdout with a 4-byte
+// little-endian signed length followed by the compressed data, or a negative length if it can't compress it. It should
+// exit when its stdin is closed. If it dies, we start it again for the next request.
+//
+// Workers is how many copies of the Command may run at once, for hosts which compress several things in parallel or
+// use compressTilesBatch(). In persistent mode, we start that many as they are needed and keep them all running.
+//
+// On Windows, the Command is run directly. Elsewhere, it is run by /bin/sh, so the same quoting works. To build it:
+// Linux: g++ -std=c++20 -O2 -shared -fPIC -o gfxcomp_exe.so gfxcomp_exe.cpp
 
 #pragma warning(push,3)
-#define WIN32_LEAN_AND_MEAN
-#include <Windows.h>
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <condition_variable>
 #include <cstdint>
-#include <string>
-#include <sstream>
+#include <cstdio>
+#include <cstring>
 #include <filesystem>
-#include <iostream>
-#include <regex>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <unordered_map>
+
+extern char** environ;
+
+// GCC and Clang export everything from a shared library unless told otherwise
+#define __declspec(x)
+#endif
 
 #include "utils.h"
 #pragma warning(pop)
 
+#ifdef _WIN32
 HINSTANCE g_hInstance;
 
 extern "C" BOOL APIENTRY DllMain(HINSTANCE hInst, DWORD, LPVOID)
@@ -95,6 +136,112 @@ int getSettingInt(const std::string& name, const int defaultValue)
     const std::filesystem::path& configFilename = getConfigFilename();
     return GetPrivateProfileInt("Settings", name.c_str(), defaultValue, configFilename.string().c_str());
 }
+#else
+const std::filesystem::path& getConfigFilename()
+{
+    static std::filesystem::path filename;
+    if (!filename.empty())
+    {
+        return filename;
+    }
+
+    // Find the shared library containing this function
+    Dl_info info{};
+    if (dladdr(reinterpret_cast<void*>(&getConfigFilename), &info) != 0 && info.dli_fname != nullptr)
+    {
+        filename = std::filesystem::absolute(info.dli_fname);
+    }
+    // We append .ini
+    filename += ".ini";
+    return filename;
+}
+
+std::string toLower(std::string s)
+{
+    std::ranges::transform(s, s.begin(), [](const unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    return s;
+}
+
+std::string trim(const std::string& s)
+{
+    const auto start = s.find_first_not_of(" \t\r\n");
+    if (start == std::string::npos)
+    {
+        return "";
+    }
+    return s.substr(start, s.find_last_not_of(" \t\r\n") - start + 1);
+}
+
+// Reads the [Settings] section like GetPrivateProfileString() does: names are not case sensitive, whitespace around
+// names and values is ignored, as are quotes around values, and lines starting with ; are comments
+std::string getSetting(const std::string& name)
+{
+    static const auto settings = []
+    {
+        std::unordered_map<std::string, std::string> result;
+        std::ifstream file(getConfigFilename());
+        std::string section;
+        for (std::string line; std::getline(file, line);)
+        {
+            line = trim(line);
+            if (line.empty() || line[0] == ';')
+            {
+                continue;
+            }
+            if (line[0] == '[')
+            {
+                section = toLower(trim(line.substr(1, line.find(']') - 1)));
+                continue;
+            }
+            const auto equals = line.find('=');
+            if (section != "settings" || equals == std::string::npos)
+            {
+                continue;
+            }
+            auto value = trim(line.substr(equals + 1));
+            if (value.size() >= 2 && value.front() == '"' && value.back() == '"')
+            {
+                value = value.substr(1, value.size() - 2);
+            }
+            result.try_emplace(toLower(trim(line.substr(0, equals))), value);
+        }
+        return result;
+    }();
+    const auto it = settings.find(toLower(name));
+    return it == settings.end() ? "" : it->second;
+}
+
+int getSettingInt(const std::string& name, const int defaultValue)
+{
+    const auto value = getSetting(name);
+    return value.empty() ? defaultValue : static_cast<int>(std::strtol(value.c_str(), nullptr, 10));
+}
+#endif
+
+struct Config
+{
+    std::string command;
+    bool isPersistent;
+    unsigned int workers;
+};
+
+const Config& getConfig()
+{
+    static const Config config = []
+    {
+        const auto mode = getSetting("Mode");
+        return Config{
+            .command = getSetting("Command"),
+            .isPersistent = mode.size() == 10
+                && std::equal(mode.begin(), mode.end(), "persistent", [](const char a, const char b)
+                {
+                    return std::tolower(static_cast<unsigned char>(a)) == b;
+                }),
+            .workers = static_cast<unsigned int>(std::max(1, getSettingInt("Workers", 1)))
+        };
+    }();
+    return config;
+}
 
 extern "C" __declspec(dllexport) const char* getName()
 {
@@ -117,6 +264,20 @@ extern "C" __declspec(dllexport) const char* getExt()
     return extension.c_str();
 }
 
+// We can't know what the program will do
+extern "C" __declspec(dllexport) uint32_t getMaxCompressedSize(
+    const uint32_t /*uncompressedBytes*/,
+    const bool /*isTilemap*/)
+{
+    return 0;
+}
+
+// Each call gets its own temp files, and calls wait for one of the Workers to be free
+extern "C" __declspec(dllexport) int32_t getThreadSafety()
+{
+    return ThreadSafety::Reentrant;
+}
+
 void replace(std::string& haystack, const std::string& needle, const std::string& replacement)
 {
     for (auto pos = haystack.find(needle); pos != std::string::npos; pos = haystack.find(needle))
@@ -127,127 +288,586 @@ void replace(std::string& haystack, const std::string& needle, const std::string
     }
 }
 
-int32_t compress(
-    const uint8_t* pSource,
-    const size_t sourceLength,
-    uint8_t* pDestination,
-    const size_t destinationLength)
-{
-    // We get a couple of temp filenames...
-    char tempPathBuf[MAX_PATH];
-    const DWORD tempPathResult = GetTempPath(MAX_PATH, tempPathBuf);
-    if (tempPathResult == 0 || tempPathResult >= MAX_PATH)
-    {
-        printf("no temp path\n");
-        return ReturnValues::CannotCompress;
-    }
-    std::ostringstream ss;
-    ss << tempPathBuf << "gfxcomp_exe_temp_in_" << rand() << ".bin";
-    const std::string inFilename(ss.str());
-    ss.str(std::string());
-    ss << tempPathBuf << "gfxcomp_exe_temp_out_" << rand() << ".bin";
-    const std::string outFilename(ss.str());
-
-    // We write the data to the first filename...
-    // Since we're using Windows API for creating the process, let's use it for files too...
-    const HANDLE fIn = CreateFile(
-        inFilename.c_str(),
-        GENERIC_WRITE,
-        FILE_SHARE_WRITE,
-        nullptr,
-        CREATE_ALWAYS,
-        FILE_ATTRIBUTE_NORMAL,
-        nullptr);
-    if (fIn == INVALID_HANDLE_VALUE)
-    {
-        printf("failed to make fIn\n");
-        return ReturnValues::CannotCompress;
-    }
-    DWORD numberOfBytesWritten;
-    if (WriteFile(fIn, pSource, sourceLength, &numberOfBytesWritten, nullptr) == FALSE || numberOfBytesWritten != sourceLength)
-    {
-        printf("failed to write to fIn\n");
-        // Failed to write
-        CloseHandle(fIn);
-        return ReturnValues::CannotCompress;
-    }
-    CloseHandle(fIn);
-
-    // Then we get the command
-    std::string command = getSetting("Command");
-    // ...and substitute the placeholders in it
-    replace(command, "%input%", inFilename);
-    replace(command, "%output%", outFilename);
+// Starting processes is serialised, so none of them inherit the pipes we make for another
+std::mutex g_startMutex;
 
+#ifdef _WIN32
+// Runs the command and waits for it to finish. Returns false if it didn't start.
+bool run(const std::string& command)
+{
     // We need to clone it
     char* commandLine = _strdup(command.c_str());
 
     // Then we run it and wait for it to complete
     PROCESS_INFORMATION processInformation{};
     STARTUPINFO startupInfo{};
-    const BOOL created = CreateProcess(
-        nullptr,
-        commandLine,
-        nullptr,
-        nullptr,
-        FALSE,
-        0,
-        nullptr,
-        getConfigFilename().parent_path().string().c_str(),
-        &startupInfo,
-        &processInformation);
+    BOOL created;
+    {
+        const std::scoped_lock lock(g_startMutex);
+        created = CreateProcess(
+            nullptr,
+            commandLine,
+            nullptr,
+            nullptr,
+            FALSE,
+            0,
+            nullptr,
+            getConfigFilename().parent_path().string().c_str(),
+            &startupInfo,
+            &processInformation);
+    }
     free(commandLine);
 
     if (created == FALSE)
     {
         printf("createprocess failed: %s\n", command.c_str());
         // Failed to run the command
-        return ReturnValues::CannotCompress;
+        return false;
     }
 
     WaitForSingleObject(processInformation.hProcess, INFINITE);
     CloseHandle(processInformation.hProcess);
     CloseHandle(processInformation.hThread);
+    return true;
+}
 
-    // We can delete the input file now
-    DeleteFile(inFilename.c_str());
-
-    // Then read in the output file
-    const HANDLE fOut = CreateFile(
-        outFilename.c_str(),
-        GENERIC_READ,
-        FILE_SHARE_READ,
-        nullptr,
-        OPEN_EXISTING,
-        FILE_ATTRIBUTE_NORMAL,
-        nullptr);
-    if (fOut == INVALID_HANDLE_VALUE)
-    {
-        DeleteFile(outFilename.c_str());
-        return ReturnValues::CannotCompress;
+// Reads or writes exactly count bytes on a pipe, returning false if it breaks first
+bool readExactly(const HANDLE handle, void* pBuffer, const uint32_t count)
+{
+    for (DWORD done = 0; done < count;)
+    {
+        DWORD numberOfBytesRead;
+        if (ReadFile(handle, static_cast<uint8_t*>(pBuffer) + done, count - done, &numberOfBytesRead, nullptr) == FALSE
+            || numberOfBytesRead == 0)
+        {
+            return false;
+        }
+        done += numberOfBytesRead;
+    }
+    return true;
+}
+
+bool writeExactly(const HANDLE handle, const void* pBuffer, const uint32_t count)
+{
+    for (DWORD done = 0; done < count;)
+    {
+        DWORD numberOfBytesWritten;
+        if (WriteFile(
+            handle,
+            static_cast<const uint8_t*>(pBuffer) + done,
+            count - done,
+            &numberOfBytesWritten,
+            nullptr) == FALSE)
+        {
+            return false;
+        }
+        done += numberOfBytesWritten;
+    }
+    return true;
+}
+#else
+// Spawns the command with /bin/sh, in the config file's directory, with the given file descriptors (or -1 to
+// inherit ours) as its stdin and stdout. Returns the pid, or -1 if it didn't start.
+pid_t spawn(const std::string& command, const int stdIn, const int stdOut)
+{
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawnattr_t attributes;
+    posix_spawnattr_init(&attributes);
+    if (stdIn >= 0)
+    {
+        posix_spawn_file_actions_adddup2(&actions, stdIn, STDIN_FILENO);
+    }
+    if (stdOut >= 0)
+    {
+        posix_spawn_file_actions_adddup2(&actions, stdOut, STDOUT_FILENO);
+    }
+    // It gets stdin, stdout and stderr, and none of the host's other files
+#if defined(__APPLE__)
+    posix_spawnattr_setflags(&attributes, POSIX_SPAWN_CLOEXEC_DEFAULT);
+    for (const auto fd : {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO})
+    {
+        posix_spawn_file_actions_addinherit_np(&actions, fd);
+    }
+#elif defined(__FreeBSD__) || (defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 34))
+    posix_spawn_file_actions_addclosefrom_np(&actions, STDERR_FILENO + 1);
+#else
+    for (int fd = STDERR_FILENO + 1; fd < sysconf(_SC_OPEN_MAX); ++fd)
+    {
+        if (fcntl(fd, F_GETFD) != -1)
+        {
+            posix_spawn_file_actions_addclose(&actions, fd);
+        }
+    }
+#endif
+    // The shell changes directory and then runs the command, which it gets as $2 so it needs no escaping
+    const std::string directory = getConfigFilename().parent_path().string();
+    const char* argv[] = {
+        "/bin/sh", "-c", "cd \"$1\" && eval \"$2\"", "gfxcomp_exe", directory.c_str(), command.c_str(), nullptr
+    };
+    pid_t pid;
+    const auto result = posix_spawn(&pid, "/bin/sh", &actions, &attributes, const_cast<char**>(argv), environ);
+    posix_spawnattr_destroy(&attributes);
+    posix_spawn_file_actions_destroy(&actions);
+    if (result != 0)
+    {
+        printf("posix_spawn failed: %s\n", command.c_str());
+        return -1;
+    }
+    return pid;
+}
+
+// Runs the command and waits for it to finish. Returns false if it didn't start.
+bool run(const std::string& command)
+{
+    pid_t pid;
+    {
+        const std::scoped_lock lock(g_startMutex);
+        pid = spawn(command, -1, -1);
+    }
+    if (pid < 0)
+    {
+        return false;
+    }
+    int status;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+    {
+    }
+    return true;
+}
+
+// Reads or writes exactly count bytes on a pipe, returning false if it breaks first
+bool readExactly(const int fd, void* pBuffer, const uint32_t count)
+{
+    for (uint32_t done = 0; done < count;)
+    {
+        const auto numberOfBytesRead = read(fd, static_cast<uint8_t*>(pBuffer) + done, count - done);
+        if (numberOfBytesRead < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (numberOfBytesRead <= 0)
+        {
+            return false;
+        }
+        done += static_cast<uint32_t>(numberOfBytesRead);
+    }
+    return true;
+}
+
+bool writeExactly(const int fd, const void* pBuffer, const uint32_t count)
+{
+    // If the worker has gone, writing raises SIGPIPE, which would kill the host. We block it on this thread while we
+    // write, and swallow it if it happened.
+    sigset_t sigPipe;
+    sigset_t oldMask;
+    sigemptyset(&sigPipe);
+    sigaddset(&sigPipe, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &sigPipe, &oldMask);
+
+    bool success = true;
+    for (uint32_t done = 0; done < count;)
+    {
+        const auto numberOfBytesWritten = write(fd, static_cast<const uint8_t*>(pBuffer) + done, count - done);
+        if (numberOfBytesWritten < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (numberOfBytesWritten < 0)
+        {
+            success = false;
+            break;
+        }
+        done += static_cast<uint32_t>(numberOfBytesWritten);
     }
-    // Check the size
-    const DWORD fileSize = GetFileSize(fOut, nullptr);
-    if (fileSize > destinationLength)
+
+    if (!success && !sigismember(&oldMask, SIGPIPE))
     {
-        // Dest buffer too small
-        CloseHandle(fOut);
-        DeleteFile(outFilename.c_str());
-        return ReturnValues::BufferTooSmall;
+        sigset_t pending;
+        sigpending(&pending);
+        if (sigismember(&pending, SIGPIPE))
+        {
+            int signal;
+            sigwait(&sigPipe, &signal);
+        }
+    }
+    pthread_sigmask(SIG_SETMASK, &oldMask, nullptr);
+    return success;
+}
+#endif
+
+// Makes a new directory for one call's temp files, so calls from any thread or process never share names
+std::filesystem::path makeTempDirectory()
+{
+    static std::atomic_uint64_t counter = 0;
+    static const auto seed = std::random_device()();
+    std::error_code error;
+    const auto tempPath = std::filesystem::temp_directory_path(error);
+    if (error)
+    {
+        printf("no temp path\n");
+        return {};
     }
-    // Read it in
-    DWORD numberOfBytesRead;
-    if (ReadFile(fOut, pDestination, fileSize, &numberOfBytesRead, nullptr) == FALSE || numberOfBytesRead != fileSize)
+    for (int attempt = 0; attempt < 100; ++attempt)
+    {
+        auto directory = tempPath / ("gfxcomp_exe_" + std::to_string(seed) + "_" + std::to_string(counter++));
+        // This fails if it already exists
+        if (std::filesystem::create_directory(directory, error))
+        {
+            return directory;
+        }
+    }
+    printf("failed to make temp directory\n");
+    return {};
+}
+
+int32_t compressWithFiles(
+    const uint8_t* pSource,
+    const size_t sourceLength,
+    uint8_t* pDestination,
+    const size_t destinationLength)
+{
+    // We get a couple of temp filenames...
+    const auto directory = makeTempDirectory();
+    if (directory.empty())
     {
-        // Problem reading
-        CloseHandle(fOut);
-        DeleteFile(outFilename.c_str());
         return ReturnValues::CannotCompress;
     }
-    CloseHandle(fOut);
-    DeleteFile(outFilename.c_str());
+    const auto inFilename = directory / "in.bin";
+    const auto outFilename = directory / "out.bin";
+    const auto result = [&]
+    {
+        // We write the data to the first filename...
+        {
+            std::ofstream fIn(inFilename, std::ios::binary);
+            if (!fIn.write(reinterpret_cast<const char*>(pSource), static_cast<std::streamsize>(sourceLength)))
+            {
+                printf("failed to write to fIn\n");
+                return ReturnValues::CannotCompress;
+            }
+        }
+
+        // Then we get the command
+        std::string command = getConfig().command;
+        // ...and substitute the placeholders in it
+        replace(command, "%input%", inFilename.string());
+        replace(command, "%output%", outFilename.string());
+
+        if (!run(command))
+        {
+            return ReturnValues::CannotCompress;
+        }
+
+        // Then read in the output file
+        std::ifstream fOut(outFilename, std::ios::binary | std::ios::ate);
+        if (!fOut)
+        {
+            return ReturnValues::CannotCompress;
+        }
+        // Check the size
+        const auto fileSize = static_cast<size_t>(fOut.tellg());
+        if (fileSize > destinationLength)
+        {
+            // Dest buffer too small
+            return ReturnValues::BufferTooSmall;
+        }
+        // Read it in
+        fOut.seekg(0);
+        if (!fOut.read(reinterpret_cast<char*>(pDestination), static_cast<std::streamsize>(fileSize)))
+        {
+            // Problem reading
+            return ReturnValues::CannotCompress;
+        }
+        return static_cast<int32_t>(fileSize);
+    }();
+
+    std::error_code error;
+    std::filesystem::remove_all(directory, error);
+    return result;
+}
+
+// The external program when Mode=persistent, which we talk to over pipes connected to its stdin and stdout
+class Worker
+{
+public:
+    Worker() = default;
+    Worker(const Worker&) = delete;
+    Worker& operator=(const Worker&) = delete;
+
+    ~Worker()
+    {
+        stop();
+    }
+
+    int32_t compress(
+        const uint8_t* pSource,
+        const uint32_t sourceLength,
+        uint8_t* pDestination,
+        const uint32_t destinationLength)
+    {
+        if (!isRunning() && !start())
+        {
+            return ReturnValues::CannotCompress;
+        }
+
+        // The lengths are little-endian, whatever we are running on
+        const uint8_t sourceLengthBytes[4] = {
+            static_cast<uint8_t>(sourceLength),
+            static_cast<uint8_t>(sourceLength >> 8),
+            static_cast<uint8_t>(sourceLength >> 16),
+            static_cast<uint8_t>(sourceLength >> 24)
+        };
+        uint8_t resultLengthBytes[4];
+        if (!writeExactly(_toWorker, sourceLengthBytes, sizeof(sourceLengthBytes))
+            || !writeExactly(_toWorker, pSource, sourceLength)
+            || !readExactly(_fromWorker, resultLengthBytes, sizeof(resultLengthBytes)))
+        {
+            printf("worker failed, will restart it next time\n");
+            stop();
+            return ReturnValues::CannotCompress;
+        }
+        const auto resultLength = static_cast<int32_t>(
+            resultLengthBytes[0]
+            | resultLengthBytes[1] << 8
+            | resultLengthBytes[2] << 16
+            | static_cast<uint32_t>(resultLengthBytes[3]) << 24);
+        if (resultLength <= 0)
+        {
+            return ReturnValues::CannotCompress;
+        }
+
+        // We have to read all of it even if it doesn't fit, so the next response starts in the right place
+        const auto length = static_cast<uint32_t>(resultLength);
+        std::vector<uint8_t> discarded;
+        uint8_t* pBuffer = pDestination;
+        if (length > destinationLength)
+        {
+            discarded.resize(length);
+            pBuffer = discarded.data();
+        }
+        if (!readExactly(_fromWorker, pBuffer, length))
+        {
+            printf("worker failed, will restart it next time\n");
+            stop();
+            return ReturnValues::CannotCompress;
+        }
+        return length > destinationLength ? ReturnValues::BufferTooSmall : resultLength;
+    }
+
+private:
+#ifdef _WIN32
+    [[nodiscard]]
+    bool isRunning() const
+    {
+        return _process != nullptr;
+    }
+
+    bool start()
+    {
+        const std::scoped_lock lock(g_startMutex);
+
+        // The pipe ends for the worker need to be inheritable, and ours not
+        SECURITY_ATTRIBUTES securityAttributes{
+            .nLength = sizeof(SECURITY_ATTRIBUTES),
+            .lpSecurityDescriptor = nullptr,
+            .bInheritHandle = TRUE
+        };
+        HANDLE workerStdIn;
+        HANDLE workerStdOut;
+        if (CreatePipe(&workerStdIn, &_toWorker, &securityAttributes, 0) == FALSE)
+        {
+            printf("failed to make pipe\n");
+            return false;
+        }
+        if (CreatePipe(&_fromWorker, &workerStdOut, &securityAttributes, 0) == FALSE)
+        {
+            printf("failed to make pipe\n");
+            CloseHandle(workerStdIn);
+            CloseHandle(_toWorker);
+            _toWorker = nullptr;
+            return false;
+        }
+        SetHandleInformation(_toWorker, HANDLE_FLAG_INHERIT, 0);
+        SetHandleInformation(_fromWorker, HANDLE_FLAG_INHERIT, 0);
+
+        const std::string& command = getConfig().command;
+        char* commandLine = _strdup(command.c_str());
+
+        PROCESS_INFORMATION processInformation{};
+        STARTUPINFO startupInfo{};
+        startupInfo.cb = sizeof(startupInfo);
+        startupInfo.dwFlags = STARTF_USESTDHANDLES;
+        startupInfo.hStdInput = workerStdIn;
+        startupInfo.hStdOutput = workerStdOut;
+        startupInfo.hStdError = GetStdHandle(STD_ERROR_HANDLE);
+        const BOOL created = CreateProcess(
+            nullptr,
+            commandLine,
+            nullptr,
+            nullptr,
+            TRUE,
+            0,
+            nullptr,
+            getConfigFilename().parent_path().string().c_str(),
+            &startupInfo,
+            &processInformation);
+        free(commandLine);
+
+        // The worker has its own copies of these now
+        CloseHandle(workerStdIn);
+        CloseHandle(workerStdOut);
+
+        if (created == FALSE)
+        {
+            printf("createprocess failed: %s\n", command.c_str());
+            stop();
+            return false;
+        }
+        CloseHandle(processInformation.hThread);
+        _process = processInformation.hProcess;
+        return true;
+    }
 
-    return static_cast<int32_t>(fileSize);
+    void stop()
+    {
+        // Closing its stdin tells the worker to exit. We don't wait for it, as we may be unloading.
+        for (const auto pHandle : {&_toWorker, &_fromWorker, &_process})
+        {
+            if (*pHandle != nullptr)
+            {
+                CloseHandle(*pHandle);
+                *pHandle = nullptr;
+            }
+        }
+    }
+
+    HANDLE _process = nullptr;
+    HANDLE _toWorker = nullptr;
+    HANDLE _fromWorker = nullptr;
+#else
+    [[nodiscard]]
+    bool isRunning() const
+    {
+        return _pid > 0;
+    }
+
+    bool start()
+    {
+        const std::scoped_lock lock(g_startMutex);
+
+        // None of these should be inherited by anything else we run; the worker gets its ends as stdin and stdout
+        int toWorker[2];
+        int fromWorker[2];
+        if (pipe2(toWorker, O_CLOEXEC) != 0)
+        {
+            printf("failed to make pipe\n");
+            return false;
+        }
+        if (pipe2(fromWorker, O_CLOEXEC) != 0)
+        {
+            printf("failed to make pipe\n");
+            close(toWorker[0]);
+            close(toWorker[1]);
+            return false;
+        }
+        _toWorker = toWorker[1];
+        _fromWorker = fromWorker[0];
+
+        _pid = spawn(getConfig().command, toWorker[0], fromWorker[1]);
+
+        // The worker has its own copies of these now
+        close(toWorker[0]);
+        close(fromWorker[1]);
+
+        if (_pid < 0)
+        {
+            stop();
+            return false;
+        }
+        return true;
+    }
+
+    void stop()
+    {
+        // Closing its stdin tells the worker to exit. We don't wait for it, as we may be unloading, but we reap it if
+        // it has already gone.
+        for (const auto pFd : {&_toWorker, &_fromWorker})
+        {
+            if (*pFd >= 0)
+            {
+                close(*pFd);
+                *pFd = -1;
+            }
+        }
+        if (_pid > 0)
+        {
+            waitpid(_pid, nullptr, WNOHANG);
+            _pid = -1;
+        }
+    }
+
+    pid_t _pid = -1;
+    int _toWorker = -1;
+    int _fromWorker = -1;
+#endif
+};
+
+// Limits how many copies of the command run at once. In persistent mode, each slot keeps its worker running between
+// calls.
+class WorkerPool
+{
+public:
+    explicit WorkerPool(const unsigned int size)
+    {
+        for (unsigned int i = 0; i < size; ++i)
+        {
+            _idle.push_back(std::make_unique<Worker>());
+        }
+    }
+
+    // Waits for a free worker
+    std::unique_ptr<Worker> acquire()
+    {
+        std::unique_lock lock(_mutex);
+        _available.wait(lock, [this] { return !_idle.empty(); });
+        auto worker = std::move(_idle.back());
+        _idle.pop_back();
+        return worker;
+    }
+
+    void release(std::unique_ptr<Worker> worker)
+    {
+        {
+            const std::scoped_lock lock(_mutex);
+            _idle.push_back(std::move(worker));
+        }
+        _available.notify_one();
+    }
+
+private:
+    std::mutex _mutex;
+    std::condition_variable _available;
+    std::vector<std::unique_ptr<Worker>> _idle;
+};
+
+int32_t compress(
+    const uint8_t* pSource,
+    const size_t sourceLength,
+    uint8_t* pDestination,
+    const size_t destinationLength)
+{
+    const auto& config = getConfig();
+    static WorkerPool pool(config.workers);
+    auto worker = pool.acquire();
+    const auto result = config.isPersistent
+        ? worker->compress(
+            pSource,
+            static_cast<uint32_t>(sourceLength),
+            pDestination,
+            static_cast<uint32_t>(destinationLength))
+        : compressWithFiles(pSource, sourceLength, pDestination, destinationLength);
+    pool.release(std::move(worker));
+    return result;
 }
 
 extern "C" __declspec(dllexport) int32_t compressTiles(
@@ -268,3 +888,36 @@ extern "C" __declspec(dllexport) int32_t compressTilemap(
 {
     return compress(pSource, width * height * 2, pDestination, destinationLength);
 }
+
+// As in utils.cpp, but spreading the items over the Workers
+extern "C" __declspec(dllexport) int32_t compressTilesBatch(
+    const uint8_t* const* pSources,
+    const uint32_t* numTiles,
+    uint8_t* const* pDestinations,
+    const uint32_t* destinationLengths,
+    int32_t* pResults,
+    const uint32_t count)
+{
+    std::atomic_uint32_t next = 0;
+    std::atomic_int32_t successCount = 0;
+    auto work = [&]
+    {
+        for (auto i = next++; i < count; i = next++)
+        {
+            pResults[i] = compressTiles(pSources[i], numTiles[i], pDestinations[i], destinationLengths[i]);
+            if (pResults[i] > 0)
+            {
+                ++successCount;
+            }
+        }
+    };
+    {
+        std::vector<std::jthread> threads;
+        for (auto i = 1u; i < std::min(getConfig().workers, count); ++i)
+        {
+            threads.emplace_back(work);
+        }
+        work();
+    }
+    return successCount;
+}
@@ -1,5 +1,8 @@
 #include <cstdint>
+#include <mutex>
 
+#include "CompressionCache.h"
+#include "CompressTilesBatch.h"
 #include "utils.h"
 
 // Header uses reserved word, so we rename it
@@ -18,6 +21,22 @@ extern "C" __declspec(dllexport) const char* getExt()
     return "exomizer3";
 }
 
+// Exomizer picks its own length and offset tables, and the format lets a match of one byte cost over 50 bits with the
+// wrong ones, so the only bound we could derive from the format is over 6 times the input. We don't give one.
+extern "C" __declspec(dllexport) uint32_t getMaxCompressedSize(
+    const uint32_t /*uncompressedBytes*/,
+    const bool /*isTilemap*/)
+{
+    return 0;
+}
+
+// Exomizer logs through globals in its own sources, which come from a submodule, so we only compress one thing at a
+// time
+extern "C" __declspec(dllexport) int32_t getThreadSafety()
+{
+    return ThreadSafety::Serialised;
+}
+
 struct io_bufs_located
 {
     struct io_bufs io;
@@ -25,7 +44,7 @@ struct io_bufs_located
 };
 
 // The actual compressor function
-static int32_t compress(
+static int32_t compressUncached(
     const uint8_t* pSource,
     const size_t sourceLength,
     uint8_t* pDestination,
@@ -43,13 +62,19 @@ static int32_t compress(
     options.flags_notrait = 1; // -T
     options.direction_forward = 1;
 
-    crunch(
-        &sourceBuffer, 
-        0, 
-        nullptr,
-        &destinationBuffer, 
-        &options, 
-        nullptr);
+    {
+        // One at a time, as getThreadSafety() says. Only the crunching touches its globals.
+        static std::mutex mutex;
+        const std::scoped_lock lock(mutex);
+
+        crunch(
+            &sourceBuffer, 
+            0, 
+            nullptr,
+            &destinationBuffer, 
+            &options, 
+            nullptr);
+    }
 
     buf_free(&sourceBuffer);
 
@@ -59,6 +84,25 @@ static int32_t compress(
     return Utils::copyToDestination(result, pDestination, destinationLength);
 }
 
+// Exomizer is slow, so we cache its results. Change the version if the options change.
+static int32_t compress(
+    const uint8_t* pSource,
+    const uint32_t sourceLength,
+    uint8_t* pDestination,
+    const uint32_t destinationLength)
+{
+    return CompressionCache::compress(
+        "Exomizer v3 -P15 -T forward v1",
+        pSource,
+        sourceLength,
+        pDestination,
+        destinationLength,
+        [&](uint8_t* pCacheDestination, const uint32_t cacheDestinationLength)
+        {
+            return compressUncached(pSource, sourceLength, pCacheDestination, cacheDestinationLength);
+        });
+}
+
 extern "C" __declspec(dllexport) int32_t compressTiles(
     const uint8_t* pSource,
     const uint32_t numTiles,
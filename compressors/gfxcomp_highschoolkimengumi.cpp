@@ -2,6 +2,7 @@
 #include <cstdint>
 #include <iterator>
 
+#include "CompressTilesBatch.h"
 #include "rle.h"
 #include "utils.h"
 
@@ -24,6 +25,19 @@ extern "C" __declspec(dllexport) const char* getExt()
     return "hskcompr";
 }
 
+// RLE adds at most one byte per 64 plus one, and we add a two byte header and a terminator
+extern "C" __declspec(dllexport) uint32_t getMaxCompressedSize(
+    const uint32_t uncompressedBytes,
+    const bool /*isTilemap*/)
+{
+    return uncompressedBytes + uncompressedBytes / 64 + 4;
+}
+
+extern "C" __declspec(dllexport) int32_t getThreadSafety()
+{
+    return ThreadSafety::Reentrant;
+}
+
 int32_t compress(
     const uint8_t* pSource,
     const uint32_t sourceLength,
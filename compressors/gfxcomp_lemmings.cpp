@@ -3,6 +3,7 @@
 #include <vector>
 #include <ranges>
 
+#include "CompressTilesBatch.h"
 #include "rle.h"
 #include "utils.h"
 
@@ -19,6 +20,20 @@ extern "C" __declspec(dllexport) const char* getExt()
     return "lemmingscompr";
 }
 
+// Each 256 byte chunk (after padding to a multiple of 8 tiles) is RLE compressed, which adds at most one byte per 64
+// plus one, with a one byte header. We can't do tilemaps.
+extern "C" __declspec(dllexport) uint32_t getMaxCompressedSize(
+    const uint32_t uncompressedBytes,
+    const bool isTilemap)
+{
+    return isTilemap ? 0 : 1 + (uncompressedBytes + 255) / 256 * (256 + 256 / 64 + 1);
+}
+
+extern "C" __declspec(dllexport) int32_t getThreadSafety()
+{
+    return ThreadSafety::Reentrant;
+}
+
 extern "C" __declspec(dllexport) int32_t compressTiles(
     const uint8_t* pSource,
     const uint32_t numTiles,
@@ -16,6 +16,19 @@ extern "C" __declspec(dllexport) const char* getExt()
     return "lsbtilemap";
 }
 
+// We keep the low byte of each tilemap entry. We can't do tiles.
+extern "C" __declspec(dllexport) uint32_t getMaxCompressedSize(
+    const uint32_t uncompressedBytes,
+    const bool isTilemap)
+{
+    return isTilemap ? uncompressedBytes / 2 : 0;
+}
+
+extern "C" __declspec(dllexport) int32_t getThreadSafety()
+{
+    return ThreadSafety::Reentrant;
+}
+
 extern "C" __declspec(dllexport) int32_t compressTilemap(
     const uint8_t* pSource,
     const uint32_t width,
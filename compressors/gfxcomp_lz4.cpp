@@ -4,6 +4,7 @@
 #include <iterator>
 #include <string>
 
+#include "CompressTilesBatch.h"
 #include "utils.h"
 
 extern "C" __declspec(dllexport) const char* getName()
@@ -26,6 +27,19 @@ extern "C" __declspec(dllexport) const char* getExt()
     return "lz4";
 }
 
+// This is LZ4's own bound for a block, which is what we emit
+extern "C" __declspec(dllexport) uint32_t getMaxCompressedSize(
+    const uint32_t uncompressedBytes,
+    const bool /*isTilemap*/)
+{
+    return uncompressedBytes + uncompressedBytes / 255 + 16;
+}
+
+extern "C" __declspec(dllexport) int32_t getThreadSafety()
+{
+    return ThreadSafety::Reentrant;
+}
+
 int32_t compress(
     const uint8_t* pSource,
     const uint32_t sourceLength,
@@ -70,6 +84,11 @@ int32_t compress(
 
     // Remove framing
     result.erase(result.begin(), result.begin() + 8); // Header + block size = 8
+    if (result.size() > getMaxCompressedSize(sourceLength, false))
+    {
+        // Should not happen, but hosts rely on it
+        return ReturnValues::CannotCompress;
+    }
     return Utils::copyToDestination(result, pDestination, destinationLength);
 }
 
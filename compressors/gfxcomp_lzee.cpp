@@ -1,8 +1,8 @@
 #include <cstdint> // uint8_t, etc
-#include <cstdlib> // free
-#include <memory>
-#include <filesystem>
+#include <mutex>
 
+#include "CompressTilesBatch.h"
+#include "MemoryFile.h"
 #include "utils.h"
 
 // Things in lzee.c
@@ -25,6 +25,22 @@ extern "C" __declspec(dllexport) const char* getExt()
     return "lzee";
 }
 
+// From the decompressor: the first byte is stored as is, then a literal costs a flag bit and a byte, and the worst
+// match is the long form of a far match, which costs two flag bits and three bytes for as little as two bytes. That's
+// 13 bits per byte at most. The end marker is another 26 bits, and the last flag byte may be partly unused.
+extern "C" __declspec(dllexport) uint32_t getMaxCompressedSize(
+    const uint32_t uncompressedBytes,
+    const bool /*isTilemap*/)
+{
+    return (uncompressedBytes * 13 + 28) / 8;
+}
+
+// lzee keeps its state in globals in lzee.c, which comes from a submodule, so we only compress one thing at a time
+extern "C" __declspec(dllexport) int32_t getThreadSafety()
+{
+    return ThreadSafety::Serialised;
+}
+
 // The actual compressor function, calling into the lzee code
 static int32_t compress(
     const uint8_t* pSource,
@@ -32,51 +48,45 @@ static int32_t compress(
     uint8_t* pDestination,
     const size_t destinationLength)
 {
-    try
+    // One at a time, as getThreadSafety() says
+    static std::mutex mutex;
+    const std::scoped_lock lock(mutex);
+
+    // lzee works on files, so we point it at MemoryFiles for our buffers. It writes the output straight into the
+    // destination.
+    MemoryFile input("lzee.in", pSource, sourceLength);
+    MemoryFile output("lzee.out", pDestination, destinationLength);
+    infile = memoryFileOpen("lzee.in", "rb");
+    outfile = memoryFileOpen("lzee.out", "wb");
+    const bool isOpen = infile != nullptr && outfile != nullptr;
+    bool isFinished = false;
+    if (isOpen)
     {
-        // LZEE doesn't have an in-memory compressor, so let's just make temp files
-        if (tmpfile_s(&infile) != 0)
-        {
-            throw std::runtime_error("Failed to make infile");
-        }
-        if (fwrite(pSource, 1, sourceLength, infile) != sourceLength)
-        {
-            throw std::runtime_error("Failed to write infile");
-        }
-        if (fseek(infile, 0, SEEK_SET) != 0)
+        // If it calls exit(), this returns instead of ending the host, and we treat it as a failure
+        MemoryFile::run([&]
         {
-            throw std::runtime_error("Failed to seek infile");
-        }
-        if (tmpfile_s(&outfile) != 0)
-        {
-            throw std::runtime_error("Failed to make outfile");
-        }
-        encode();
-        if (fclose(infile) != 0)
-        {
-            throw std::runtime_error("Failed to close input file");
-        }
-        const auto outSize = ftell(outfile);
-        std::vector<uint8_t> result(outSize);
-        if (fseek(outfile, 0, SEEK_SET) != 0)
-        {
-            throw std::runtime_error("Failed to seek outfile");
-        }
-        if (fread_s(result.data(), result.size(), 1, result.size(), outfile) != result.size())
-        {
-            throw std::runtime_error("Failed to read outfile");
-        }
-        if (fclose(outfile) != 0)
-        {
-            throw std::runtime_error("Failed to close output file");
-        }
-        return Utils::copyToDestination(result, pDestination, destinationLength);
+            encode();
+            isFinished = true;
+            return 0;
+        });
+    }
+
+    // We don't leave it pointing at them, as they go away when we return. Closing them directly is safe even if
+    // lzee closed them itself.
+    input.close();
+    output.close();
+    infile = nullptr;
+    outfile = nullptr;
+
+    if (output.isTruncated())
+    {
+        return ReturnValues::BufferTooSmall;
     }
-    catch (const std::exception& e)
+    if (!isFinished)
     {
-        printf("%s\n", e.what());
         return ReturnValues::CannotCompress;
     }
+    return static_cast<int32_t>(output.size());
 }
 
 extern "C" __declspec(dllexport) int32_t compressTiles(
@@ -1,5 +1,6 @@
 #include <cstdint>
 
+#include "CompressTilesBatch.h"
 #include "utils.h"
 #include "lzsa/src/lib.h"
 
@@ -39,6 +40,19 @@ extern "C" __declspec(dllexport) const char* getExt()
     return "lzsa2";
 }
 
+// LZSA tells us. This includes the frame headers, which we don't emit, so it is a little generous.
+extern "C" __declspec(dllexport) uint32_t getMaxCompressedSize(
+    const uint32_t uncompressedBytes,
+    const bool /*isTilemap*/)
+{
+    return static_cast<uint32_t>(lzsa_get_max_compressed_size_inmem(uncompressedBytes));
+}
+
+extern "C" __declspec(dllexport) int32_t getThreadSafety()
+{
+    return ThreadSafety::Reentrant;
+}
+
 extern "C" __declspec(dllexport) int32_t compressTiles(
     const uint8_t* pSource,
     const uint32_t numTiles,
@@ -2,6 +2,7 @@
 #include <iterator>
 #include <vector>
 
+#include "CompressTilesBatch.h"
 #include "rle.h"
 #include "utils.h"
 
@@ -18,6 +19,20 @@ extern "C" __declspec(dllexport) const char* getExt()
     return "mkre2compr";
 }
 
+// We never choose more than the LZ encoding, which is at worst all raw bytes at 9 bits each, plus a one byte header
+// and a terminator. We can't do tilemaps.
+extern "C" __declspec(dllexport) uint32_t getMaxCompressedSize(
+    const uint32_t uncompressedBytes,
+    const bool isTilemap)
+{
+    return isTilemap ? 0 : uncompressedBytes + (uncompressedBytes + 8) / 8 + 3;
+}
+
+extern "C" __declspec(dllexport) int32_t getThreadSafety()
+{
+    return ThreadSafety::Reentrant;
+}
+
 std::vector<uint8_t> compressRle(const std::vector<uint8_t>& data)
 {
     std::vector<uint8_t> result;
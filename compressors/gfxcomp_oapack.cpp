@@ -1,9 +1,12 @@
 #include <cstdint>
 #include <algorithm>
+#include <mutex>
 
+#include "CompressTilesBatch.h"
 #include "utils.h"
 
-// Forward declares for oapack stuff. It uses globals so we have to poke into them to make it work.
+// Forward declares for oapack stuff. It keeps its input, output and state in globals, in sources which come from a
+// submodule, so we have to poke into them to make it work.
 int FindOptimalSolution();
 int EmitCompressed();
 extern unsigned char* packedData;
@@ -13,6 +16,10 @@ extern int size;
 
 int32_t compress(const uint8_t* pSource, const size_t sourceLength, uint8_t* pDestination, const size_t destinationLength)
 {
+    // One at a time, as getThreadSafety() says
+    static std::mutex mutex;
+    const std::scoped_lock lock(mutex);
+
     data = const_cast<unsigned char*>(pSource);
     size = static_cast<int>(sourceLength);
 
@@ -45,6 +52,21 @@ extern "C" __declspec(dllexport) const char* getExt()
     return "oapack";
 }
 
+// oapack finds the optimal aPLib encoding, so it is never bigger than all literals, which aPLib bounds like this
+extern "C" __declspec(dllexport) uint32_t getMaxCompressedSize(
+    const uint32_t uncompressedBytes,
+    const bool /*isTilemap*/)
+{
+    return uncompressedBytes * 9 / 8 + 16;
+}
+
+// oapack works on globals, so we only compress one thing at a time. Making it reentrant needs its state moving into a
+// per-call struct in the oapack sources, as zx7/compress.c does with Writer.
+extern "C" __declspec(dllexport) int32_t getThreadSafety()
+{
+    return ThreadSafety::Serialised;
+}
+
 extern "C" __declspec(dllexport) int32_t compressTiles(
     const uint8_t* pSource,
     const uint32_t numTiles,
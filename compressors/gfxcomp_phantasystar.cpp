@@ -2,6 +2,7 @@
 #include <cstdint>
 #include <iterator>
 
+#include "CompressTilesBatch.h"
 #include "utils.h"
 #include "rle.h"
 
@@ -76,6 +77,19 @@ extern "C" __declspec(dllexport) const char* getExt()
     return "pscompr";
 }
 
+// RLE adds at most one byte per 64 plus one, and we add a terminator, for each of up to four bitplanes
+extern "C" __declspec(dllexport) uint32_t getMaxCompressedSize(
+    const uint32_t uncompressedBytes,
+    const bool /*isTilemap*/)
+{
+    return uncompressedBytes + uncompressedBytes / 64 + 8;
+}
+
+extern "C" __declspec(dllexport) int32_t getThreadSafety()
+{
+    return ThreadSafety::Reentrant;
+}
+
 extern "C" __declspec(dllexport) int32_t compressTiles(
     const uint8_t* pSource,
     const uint32_t numTiles,
@@ -2,6 +2,7 @@
 #include <map>
 #include <cstdint>
 
+#include "CompressTilesBatch.h"
 #include "utils.h"
 
 void findMostCommonValue(std::vector<uint8_t>::const_iterator data, uint8_t& value, int& count)
@@ -213,6 +214,20 @@ extern "C" __declspec(dllexport) const char* getExt()
     return "psgcompr";
 }
 
+// No bitplane is bigger than 8 bytes, and we add a method byte per tile after a 2 byte header.
+// We can't do tilemaps.
+extern "C" __declspec(dllexport) uint32_t getMaxCompressedSize(
+    const uint32_t uncompressedBytes,
+    const bool isTilemap)
+{
+    return isTilemap ? 0 : 2 + uncompressedBytes + uncompressedBytes / 32;
+}
+
+extern "C" __declspec(dllexport) int32_t getThreadSafety()
+{
+    return ThreadSafety::Reentrant;
+}
+
 extern "C" __declspec(dllexport) int32_t compressTiles(
     const uint8_t* pSource,
     const uint32_t numTiles,
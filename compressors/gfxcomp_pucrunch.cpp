@@ -1,7 +1,8 @@
 #include <cstdint>
-#include <algorithm>
-#include <cstdio>
+#include <mutex>
 
+#include "CompressTilesBatch.h"
+#include "MemoryFile.h"
 #include "utils.h"
 
 // Pucrunch's main function
@@ -9,68 +10,33 @@ int main(int argc, char* argv[]);
 
 int32_t compress(const uint8_t* pSource, const size_t sourceLength, uint8_t* pDestination, const size_t destinationLength)
 {
-    // Pucrunch only likes to work on files so we have to write them to disk...
-    char inFilename[L_tmpnam_s];
-    if (tmpnam_s(inFilename) != 0)
+    // One at a time, as getThreadSafety() says
+    static std::mutex mutex;
+    const std::scoped_lock lock(mutex);
+
+    // Pucrunch only likes to work on files, so we give it these names, which MemoryFile turns into our buffers. It
+    // writes the output straight into the destination.
+    MemoryFile input("pucrunch.in", pSource, sourceLength);
+    MemoryFile output("pucrunch.out", pDestination, destinationLength);
+
+    // We invoke the Pucrunch main function directly. If it calls exit(), MemoryFile::run() turns that into a return
+    // instead of ending the host.
+    const char* argv[] = {"", "-d", "-c0", "pucrunch.in", "pucrunch.out"};
+    const auto status = MemoryFile::run([&]
     {
-        return ReturnValues::CannotCompress;
-    }
-    FILE* f;
-    if (fopen_s(&f, inFilename, "wb") != 0)
-    {
-        return ReturnValues::CannotCompress;
-    }
-    fwrite(pSource, 1, sourceLength, f);
-    fclose(f);
+        return main(5, const_cast<char**>(argv)); // NOLINT(clang-diagnostic-main)
+    });
 
-    char outFilename[L_tmpnam_s];
-    if (tmpnam_s(outFilename) != 0)
+    // It may fail because it couldn't write it all, so we check that first
+    if (output.isTruncated())
     {
-        remove(inFilename);
-        return ReturnValues::CannotCompress;
+        return ReturnValues::BufferTooSmall;
     }
-
-    // We invoke the Pucrunch main function directly...
-    const char* argv[] = {"", "-d", "-c0", inFilename, outFilename};
-    const auto status = main(5, const_cast<char**>(argv)); // NOLINT(clang-diagnostic-main)
-
-    remove(inFilename);
-
     if (status != 0)
     {
-        remove(outFilename);
-        return ReturnValues::CannotCompress;
-    }
-
-    // Read the file back in again
-    if (fopen_s(&f, outFilename, "rb") != 0 ||
-        fseek(f, 0, SEEK_END) != 0)
-    {
-        fclose(f);
-        remove(outFilename);
-        return ReturnValues::CannotCompress;
-    }
-
-    const size_t compressedSize = ftell(f);
-
-    if (compressedSize > destinationLength)
-    {
-        fclose(f);
-        remove(outFilename);
-        return ReturnValues::BufferTooSmall; // Buffer too small
-    }
-
-    if (fseek(f, 0, SEEK_SET) != 0 ||
-        fread_s(pDestination, destinationLength, 1, compressedSize, f) != compressedSize)
-    {
-        fclose(f);
-        remove(outFilename);
         return ReturnValues::CannotCompress;
     }
-
-    fclose(f);
-    remove(outFilename);
-    return static_cast<uint32_t>(compressedSize);
+    return static_cast<int32_t>(output.size());
 }
 
 extern "C" __declspec(dllexport) const char* getName()
@@ -86,6 +52,24 @@ extern "C" __declspec(dllexport) const char* getExt()
     return "pucrunch";
 }
 
+// From the decompressor: the header is 16 bytes plus an RLE table of up to 31 bytes. The worst way to encode a byte is
+// as a literal which matches the escape code, which costs up to 21 bits (an 8 bit escape code, the escape sequence and
+// a new escape code); every match and run costs less than that per byte. The end marker is up to 36 bits, and the last
+// byte may be partly unused.
+extern "C" __declspec(dllexport) uint32_t getMaxCompressedSize(
+    const uint32_t uncompressedBytes,
+    const bool /*isTilemap*/)
+{
+    return 47 + (uncompressedBytes * 21 + 36 + 7) / 8;
+}
+
+// Pucrunch keeps its state in globals in pucrunch.c, which comes from a submodule, so we only compress one thing at a
+// time. Its files are only in memory, though.
+extern "C" __declspec(dllexport) int32_t getThreadSafety()
+{
+    return ThreadSafety::Serialised;
+}
+
 extern "C" __declspec(dllexport) int32_t compressTiles(
     const uint8_t* pSource,
     const uint32_t numTiles,
@@ -1,5 +1,6 @@
 #include <algorithm>
 
+#include "CompressTilesBatch.h"
 #include "utils.h"
 
 extern "C" __declspec(dllexport) const char* getName()
@@ -15,6 +16,19 @@ extern "C" __declspec(dllexport) const char* getExt()
     return "bin";
 }
 
+// No compression, no overhead
+extern "C" __declspec(dllexport) uint32_t getMaxCompressedSize(
+    const uint32_t uncompressedBytes,
+    const bool /*isTilemap*/)
+{
+    return uncompressedBytes;
+}
+
+extern "C" __declspec(dllexport) int32_t getThreadSafety()
+{
+    return ThreadSafety::Reentrant;
+}
+
 extern "C" __declspec(dllexport) int32_t compressTiles(
     const uint8_t* pSource,
     const uint32_t numTiles,
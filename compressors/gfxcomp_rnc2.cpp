@@ -1,5 +1,7 @@
 #include <cstdint>
+#include <cstdlib>
 
+#include "CompressTilesBatch.h"
 #include "utils.h"
 
 extern "C" __declspec(dllexport) const char* getName()
@@ -12,6 +14,21 @@ extern "C" __declspec(dllexport) const char* getExt()
     return "rnc2";
 }
 
+// From the decompressor: after the 18 byte header, a literal costs a flag bit and a byte, and every match or raw run
+// costs less than that per byte. Each block ends with a 13 bit marker, and the header counts blocks in a byte, so there
+// are at most 256 of them. The first two bits are unused.
+extern "C" __declspec(dllexport) uint32_t getMaxCompressedSize(
+    const uint32_t uncompressedBytes,
+    const bool /*isTilemap*/)
+{
+    return 18 + (uncompressedBytes * 9 + 2 + 256 * 13 + 7) / 8;
+}
+
+extern "C" __declspec(dllexport) int32_t getThreadSafety()
+{
+    return ThreadSafety::Reentrant;
+}
+
 // "Includes" for C
 
 extern "C"
@@ -81,24 +98,39 @@ extern "C"
     int do_pack(vars_t *v);
 }
 
-int32_t compress(const uint8_t* pSource, const size_t sourceLength, uint8_t* pDestination, const size_t destinationLength)
+int32_t compress(
+    const uint8_t* pSource,
+    const size_t sourceLength,
+    uint8_t* pDestination,
+    const size_t destinationLength)
 {
     // Fill in vars struct, based on what we see in main.c in "p"ack mode
-    auto v = Utils::makeUniqueForMalloc(init_vars());
+    const auto v = Utils::makeUniqueForMalloc(init_vars());
     v->puse_mode = 'p';
     v->method = 2;
     v->dict_size = 0x1000;
     v->max_matches = 0xFF;
     v->file_size = sourceLength;
-    auto sourceCopy = Utils::toVector(pSource, sourceLength);
-    v->input = sourceCopy.data();
-
-    // We need to supply buffers of this size - 30MB!
-    constexpr int MAX_BUF_SIZE = 0x1E00000;
-    std::vector<uint8_t> output(MAX_BUF_SIZE);
-    v->output = output.data();
-    std::vector<uint8_t> temp(MAX_BUF_SIZE);
-    v->temp = temp.data();
+    // The packer only reads its input, so we can give it ours
+    v->input = const_cast<uint8_t*>(pSource);
+
+    // The packer's own main() gives it 30MB output and temp buffers whatever the input size, and it doesn't check
+    // it stays inside them, so we give it the same. It expects them to be zeroed, as it got them from calloc(). We do
+    // the same: blocks this big come straight from the OS as zero pages, which are only paged in when written, so we
+    // only pay for what it uses, and as they are fresh each time there's nothing to clear afterwards.
+    constexpr size_t bufferSize = 0x1E00000;
+    if (sourceLength > bufferSize)
+    {
+        return ReturnValues::CannotCompress;
+    }
+    const auto output = Utils::makeUniqueForMalloc(static_cast<uint8_t*>(calloc(bufferSize, 1)));
+    const auto temp = Utils::makeUniqueForMalloc(static_cast<uint8_t*>(calloc(bufferSize, 1)));
+    if (output == nullptr || temp == nullptr)
+    {
+        return ReturnValues::CannotCompress;
+    }
+    v->output = output.get();
+    v->temp = temp.get();
 
     // Then we call the packer...
     if (do_pack(v.get()) != 0)
@@ -106,16 +138,20 @@ int32_t compress(const uint8_t* pSource, const size_t sourceLength, uint8_t* pDe
         return ReturnValues::CannotCompress;
     }
 
-    output.resize(v->output_offset);
+    // If it went past the end of the buffers, the damage is done, but we still don't trust the result
+    if (v->output_offset > bufferSize || v->temp_offset > bufferSize)
+    {
+        return ReturnValues::CannotCompress;
+    }
 
-    if (output.size() == sourceLength)
+    if (v->output_offset == sourceLength)
     {
         // Seems to indicate a refusal to compress?
         return ReturnValues::CannotCompress;
     }
 
     // Copy to the destination buffer if it fits
-    return Utils::copyToDestination(output, pDestination, destinationLength);
+    return Utils::copyToDestination(output.get(), v->output_offset, pDestination, destinationLength);
 }
 
 extern "C" __declspec(dllexport) int32_t compressTiles(
@@ -138,3 +174,26 @@ extern "C" __declspec(dllexport) int32_t compressTilemap(
     // Compress tilemap
     return compress(pSource, width * height * 2, pDestination, destinationLength);
 }
+
+// As compressTiles. The packer needs fresh buffers every time, so there is nothing to keep in the context.
+extern "C" __declspec(dllexport) int32_t compressTilesEx(
+    Context* /*pContext*/,
+    const uint8_t* pSource,
+    const uint32_t numTiles,
+    uint8_t* pDestination,
+    const uint32_t destinationLength)
+{
+    return compress(pSource, numTiles * 32, pDestination, destinationLength);
+}
+
+// As compressTilemap. The packer needs fresh buffers every time, so there is nothing to keep in the context.
+extern "C" __declspec(dllexport) int32_t compressTilemapEx(
+    Context* /*pContext*/,
+    const uint8_t* pSource,
+    const uint32_t width,
+    const uint32_t height,
+    uint8_t* pDestination,
+    const uint32_t destinationLength)
+{
+    return compress(pSource, width * height * 2, pDestination, destinationLength);
+}
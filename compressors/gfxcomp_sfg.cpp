@@ -2,7 +2,10 @@
 #include <vector>
 #include <cstdint>
 
+#include "CompressTilesBatch.h"
 #include "InterleavedBitStream.h"
+#include "MatchFinder.h"
+#include "OptimalParser.h"
 #include "utils.h"
 
 // Compression format:
@@ -12,29 +15,28 @@
 // - Literals are a 1 in the bitstream and a byte of data -> 9 bits
 // - LZ matches have a 5-bit length and 11-bit offset encoded as two bytes in the data
 
-struct Match
+struct Format
 {
-    enum class Type: uint8_t
+    enum class Token: uint8_t
     {
         Invalid,
         Raw,
         Lz
     };
 
-    Type type{};
-    int costToEndInBits{};
-    int offset{};
-    int count{};
+    // Bits
+    using Cost = int;
 };
 
 static int32_t compress(
+    Context& context,
     const uint8_t* pSource,
     const size_t sourceLength,
     uint8_t* pDestination,
     const size_t destinationLength)
 {
     // Copy the data into a buffer
-    auto source = Utils::toVector(pSource, sourceLength);
+    auto& source = Utils::toVector(context, pSource, sourceLength);
 
     // Deinterleave it
     for (size_t i = 0; i < sourceLength; i += 32)
@@ -47,92 +49,79 @@ static int32_t compress(
         std::ranges::copy(tileBytes, source.begin() + i);
     }
 
+    // LZ matches are 3..34 bytes from up to 2048 bytes before, and may overlap the current position
+    const MatchFinder matchFinder(source, 2048, 3, 34, true);
+
     // At each offset from the end, compute the cheapest option
-    std::vector<Match> bestMatches(sourceLength + 1);
+    auto& parser = context.get<OptimalParser<Format>>();
+    parser.reset(sourceLength);
     for (int position = static_cast<int>(sourceLength) - 1; position >= 0; --position)
     {
         // We can always do a raw match to position + 1
-        bestMatches[position].type = Match::Type::Raw;
-        bestMatches[position].costToEndInBits = 9 + bestMatches[position + 1].costToEndInBits;
+        parser.offer(position, Format::Token::Raw, 1, 0, 9 + parser.costToEnd(position + 1));
 
         // Then look for LZ matches...
-        const auto maxMatchLength = std::min(static_cast<int>(sourceLength) - position, 34);
-        for (auto matchLength = 3; matchLength <= maxMatchLength; ++matchLength)
+        auto matchLength = 3;
+        for (const auto& [longestLength, offset] : matchFinder.find(position))
         {
-            // Look for a match
-            // The relative haystack range is from -2048 to -1 + length
-            // The relative needle range is from 0 to length
-            const auto& r = std::ranges::find_end(
-                source.begin() + std::max(0, position - 2048),
-                source.begin() + position + matchLength - 1,
-                source.begin() + position,
-                source.begin() + position + matchLength);
-            if (r.begin() != r.end())
+            // This offset is the nearest for all lengths up to longestLength
+            for (; matchLength <= longestLength; ++matchLength)
             {
-                // We have a match
-                // Cost is 2 bytes + 1 bit
-                if (const auto costToEnd = 17 + bestMatches[position + matchLength].costToEndInBits; 
-                    costToEnd < bestMatches[position].costToEndInBits)
+                // Zero encoding is a sentinel, so we have to skip it.
+                // That corresponds to matchLength == 3 and offset == 2048
+                if (matchLength == 3 && offset == 2048)
                 {
-                    // Zero encoding is a sentinel, so we have to skip it.
-                    // That corresponds to matchLength == 3 and offset == 2048
-                    auto offset = position - std::distance(source.begin(), r.begin());
-                    if (matchLength == 3 && offset == 2048)
-                    {
-                        continue;
-                    }
-                    bestMatches[position].type = Match::Type::Lz;
-                    bestMatches[position].offset = offset;
-                    bestMatches[position].count = matchLength;
-                    bestMatches[position].costToEndInBits = costToEnd;
+                    continue;
                 }
-            }
-            else
-            {
-                // No match, so longer ones won't work either
-                break;
+                // Cost is 2 bytes + 1 bit
+                parser.offer(
+                    position,
+                    Format::Token::Lz,
+                    matchLength,
+                    offset,
+                    17 + parser.costToEnd(position + matchLength));
             }
         }
     }
 
     // Choose the best route to the end
-    InterleavedBitStream b(true);
-    for (size_t position = 0; position < sourceLength; /* increment in loop */)
+    OutputSink sink(pDestination, destinationLength);
+    InterleavedBitStream b(sink, true);
+    parser.trace([&](const int position, const Format::Token token, const int length, const int offset)
     {
-        const auto& match = bestMatches[position];
-        switch (match.type)
+        switch (token)
         {
-        case Match::Type::Raw:
+        case Format::Token::Raw:
             b.addBit(1);
             b.addByte(source[position]);
-            position += 1;
             break;
-        case Match::Type::Lz:
+        case Format::Token::Lz:
             {
                 b.addBit(0);
                 const auto hl = static_cast<uint16_t>(
-                    (((match.count - 3) & 0b11111) << 8) |      // %---ccccc--------
-                    (((-match.offset) & 0b11100000000) << 5) |  // %hhh-------------
-                    ((-match.offset) & 0b11111111)              // %--------llllllll
+                    (((length - 3) & 0b11111) << 8) |     // %---ccccc--------
+                    (((-offset) & 0b11100000000) << 5) |  // %hhh-------------
+                    ((-offset) & 0b11111111)              // %--------llllllll
                 );
                 b.addByte((hl >> 0) & 0xff);
                 b.addByte((hl >> 8) & 0xff);
-                position += match.count;
             }
             break;
-        case Match::Type::Invalid: [[fallthrough]];
+        case Format::Token::Invalid: [[fallthrough]];
         default:
             // should not happen
             break;
         }
-    }
+        // Stop once it can't fit
+        return !sink.isFull();
+    });
 
     // Then add the terminator
     b.addBit(0);
     b.addByte(0);
     b.addByte(0);
 
-    return Utils::copyToDestination(b.buffer(), pDestination, destinationLength);
+    return sink.result();
 }
 
 extern "C" __declspec(dllexport) const char* getName()
@@ -149,6 +138,20 @@ extern "C" __declspec(dllexport) const char* getExt()
     return "sfg";
 }
 
+// The optimal parse is never bigger than all raw bytes at 9 bits each, plus the 17 bit terminator.
+// We can't do tilemaps.
+extern "C" __declspec(dllexport) uint32_t getMaxCompressedSize(
+    const uint32_t uncompressedBytes,
+    const bool isTilemap)
+{
+    return isTilemap ? 0 : uncompressedBytes + (uncompressedBytes + 8) / 8 + 2;
+}
+
+extern "C" __declspec(dllexport) int32_t getThreadSafety()
+{
+    return ThreadSafety::Reentrant;
+}
+
 extern "C" __declspec(dllexport) int32_t compressTiles(
     const uint8_t* pSource,
     const uint32_t numTiles,
@@ -156,5 +159,17 @@ extern "C" __declspec(dllexport) int32_t compressTiles(
     const uint32_t destinationLength)
 {
     // Compress tiles
-    return compress(pSource, numTiles * 32, pDestination, destinationLength);
+    Context context;
+    return compress(context, pSource, numTiles * 32, pDestination, destinationLength);
+}
+
+// As compressTiles, but reusing memory from a context made by createContext()
+extern "C" __declspec(dllexport) int32_t compressTilesEx(
+    Context* pContext,
+    const uint8_t* pSource,
+    const uint32_t numTiles,
+    uint8_t* pDestination,
+    const uint32_t destinationLength)
+{
+    return compress(*pContext, pSource, numTiles * 32, pDestination, destinationLength);
 }
@@ -2,15 +2,26 @@
 #include <iterator>
 #include <string>
 #include <ranges>
+#include <mutex>
 
 #pragma warning(push, 0)
+#include "CompressionCache.h"
+#include "CompressTilesBatch.h"
 #include "utils.h"
 #include "shrinkler/cruncher/HunkFile.h"
 #include "shrinkler/cruncher/Pack.h"
 #pragma warning(pop)
 
-int32_t compress(const uint8_t* pSource, const size_t sourceLength, uint8_t* pDestination, const size_t destinationLength)
+int32_t compressUncached(
+    const uint8_t* pSource,
+    const size_t sourceLength,
+    uint8_t* pDestination,
+    const size_t destinationLength)
 {
+    // One at a time, as getThreadSafety() says
+    static std::mutex mutex;
+    const std::scoped_lock lock(mutex);
+
     PackParams params
     {
         .parity_context = false, // "Disable parity context - better on byte-oriented data"
@@ -43,6 +54,25 @@ int32_t compress(const uint8_t* pSource, const size_t sourceLength, uint8_t* pDe
     return Utils::copyToDestination(packBuffer, pDestination, destinationLength);
 }
 
+// Shrinkler is very slow, so we cache its results. Change the version if the parameters change.
+int32_t compress(
+    const uint8_t* pSource,
+    const uint32_t sourceLength,
+    uint8_t* pDestination,
+    const uint32_t destinationLength)
+{
+    return CompressionCache::compress(
+        "Shrinkler i3 l3 s3000 p300 m30 r10000 v1",
+        pSource,
+        sourceLength,
+        pDestination,
+        destinationLength,
+        [&](uint8_t* pCacheDestination, const uint32_t cacheDestinationLength)
+        {
+            return compressUncached(pSource, sourceLength, pCacheDestination, cacheDestinationLength);
+        });
+}
+
 extern "C" __declspec(dllexport) const char* getName()
 {
     // A pretty name for this compression type
@@ -55,6 +85,22 @@ extern "C" __declspec(dllexport) const char* getExt()
     return "shrinkler";
 }
 
+// Shrinkler's adaptive range coder has no useful worst case: what a byte costs depends on how its probabilities have
+// drifted, and the packer doesn't tell us. We don't give one.
+extern "C" __declspec(dllexport) uint32_t getMaxCompressedSize(
+    const uint32_t /*uncompressedBytes*/,
+    const bool /*isTilemap*/)
+{
+    return 0;
+}
+
+// Shrinkler's sources, which come from a submodule, aren't written with threads in mind (it prints progress as it
+// goes), so we only compress one thing at a time. Cached results don't wait for that.
+extern "C" __declspec(dllexport) int32_t getThreadSafety()
+{
+    return ThreadSafety::Serialised;
+}
+
 extern "C" __declspec(dllexport) int32_t compressTiles(
     const uint8_t* pSource,
     const uint32_t numTiles,
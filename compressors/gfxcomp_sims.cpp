@@ -1,8 +1,11 @@
 #include <algorithm>
+#include <array>
 #include <cstdint>
-#include <iterator>
 #include <stdexcept>
 
+#include "CompressTilesBatch.h"
+#include "OptimalParser.h"
+#include "OutputSink.h"
 #include "utils.h"
 
 extern "C" __declspec(dllexport) const char* getName()
@@ -18,81 +21,136 @@ extern "C" __declspec(dllexport) const char* getExt()
     return "sims";
 }
 
+// The optimal parse is never bigger than raw runs of 64 bytes, which cost one byte each, after the two byte length.
+// We can't do tilemaps.
+extern "C" __declspec(dllexport) uint32_t getMaxCompressedSize(
+    const uint32_t uncompressedBytes,
+    const bool isTilemap)
+{
+    return isTilemap ? 0 : 2 + uncompressedBytes + (uncompressedBytes + 63) / 64;
+}
+
+extern "C" __declspec(dllexport) int32_t getThreadSafety()
+{
+    return ThreadSafety::Reentrant;
+}
+
 namespace
 {
-    struct Match
+    struct Format
     {
-        enum class Modes: uint8_t
+        enum class Token: uint8_t
         {
-            Default,
-            Rle,
-            Lz,
-            Raw
+            None,
+            Rle,    // %110nnccc                Repeat n+1 bytes c+2 times
+                    // %111nnccc %cccccccc      Repeat n+1 bytes c+2 times
+            Lz,     // %0ooooooo %oooonnnn      Copy n+2 bytes from offset -o
+            Raw     // %10nnnnnn                Copy n+1 bytes from the data
         };
 
-        explicit Match(const Modes mode) :
-            mode(mode),
-            offset(-1),
-            costToEnd(std::numeric_limits<int>::max()),
-            length(-1),
-            extra(-1)
+        using Cost = int;
+    };
+
+    // Finds the nearest LZ source for each match length at a position, in one pass over the candidates.
+    // Sources must lie entirely within the 2047 bytes before the position.
+    class MatchFinder
+    {
+    public:
+        static constexpr int minLength = 2;
+        static constexpr int maxLength = 17;
+        static constexpr int maxOffset = 2047;
+
+        explicit MatchFinder(const std::vector<uint8_t>& data):
+            _data(data),
+            _previous(data.size(), -1)
         {
+            // We chain together all positions starting with the same two bytes
+            std::vector lastSeen(1 << 16, -1);
+            for (int position = 0; position + 1 < static_cast<int>(data.size()); ++position)
+            {
+                auto& last = lastSeen[data[position] << 8 | data[position + 1]];
+                _previous[position] = last;
+                last = position;
+            }
         }
 
-        // Match type
-        Modes mode;
-        // Location in source data
-        int offset;
-        // Encoding cost to end of data
-        int costToEnd;
-        // Other parameters specific to the match type
-        int length;
-        int extra;
-
-        int writeTo(std::vector<uint8_t>& vector, const std::vector<uint8_t>& data) const
+        // Fills nearestSource[length] with the highest source position matching that many bytes at position,
+        // or -1 if there is none. Returns the longest length found, or 0 if there is none.
+        int find(const int position, std::array<int, maxLength + 1>& nearestSource) const
         {
-            switch (mode)
+            nearestSource.fill(-1);
+            const int lenData = static_cast<int>(_data.size());
+            const int limit = std::min(lenData - position, maxLength);
+            if (limit < minLength)
             {
-            case Modes::Rle:
-                if (extra <= 9)
-                {
-                    vector.push_back(static_cast<uint8_t>(0b11000000 | ((length - 1) << 3) | (extra - 2)));
-                }
-                else
+                return 0;
+            }
+            int longest = 0;
+            for (int source = _previous[position];
+                 source >= 0 && source >= position - maxOffset;
+                 source = _previous[source])
+            {
+                // The source may not overlap the position
+                const int maxMatch = std::min(limit, position - source);
+                // The chain guarantees the first two bytes match
+                int length = minLength;
+                while (length < maxMatch && _data[source + length] == _data[position + length])
                 {
-                    vector.push_back(static_cast<uint8_t>(0b11100000 | ((length - 1) << 3) | ((extra - 2) >> 8)));
-                    vector.push_back((extra - 2) & 0xff);
+                    ++length;
                 }
-                for (int i = 0; i < length; ++i)
+                length = std::min(length, maxMatch);
+                // We walk the chain from nearest to furthest, so every length up to the longest seen so far already
+                // has a nearer source
+                for (int n = longest + 1; n <= length; ++n)
                 {
-                    vector.push_back(data[offset + i]);
+                    nearestSource[n] = source;
                 }
-                return length * extra;
-            case Modes::Lz:
-                vector.push_back(static_cast<uint8_t>(extra >> 4));
-                vector.push_back(static_cast<uint8_t>(((extra & 0b1111) << 4) | (length - 2)));
-                return length;
-            case Modes::Raw:
-                vector.push_back(static_cast<uint8_t>(0b10000000 | (length - 1)));
-                for (int i = 0; i < length; ++i)
+                longest = std::max(longest, length);
+                if (longest == limit)
                 {
-                    vector.push_back(data[offset + i]);
+                    break;
                 }
-                return length;
-            case Modes::Default:
-                throw std::runtime_error("Unexpected mode=default");
             }
-            throw std::runtime_error("Unexpected mode=default");
+            return longest;
         }
+
+    private:
+        const std::vector<uint8_t>& _data;
+        std::vector<int> _previous;
     };
 
-    std::vector<uint8_t> compress(const std::vector<uint8_t>& data)
+    void compress(Context& context, const std::vector<uint8_t>& data, OutputSink& sink)
     {
         // Best matches found so far
-        std::vector bestMatches(data.size(), Match(Match::Modes::Default));
+        auto& parser = context.get<OptimalParser<Format>>();
+        parser.reset(data.size());
 
         auto lenData = static_cast<int>(data.size());
 
+        const MatchFinder matchFinder(data);
+        std::array<int, MatchFinder::maxLength + 1> nearestSource{};
+
+        OptimalParser<Format>::RunFinder rawRunFinder(Format::Token::Raw, 1, 64, 1, 1);
+
+        // For each RLE sequence length 1..4, count how many times the sequence at each position is repeated
+        // immediately after it. We fill these from the right so each is one comparison from its neighbour.
+        std::array<std::vector<int>, 5> repeats;
+        for (int rleMatchLength = 1; rleMatchLength < 5; ++rleMatchLength)
+        {
+            auto& counts = repeats[rleMatchLength];
+            counts.resize(data.size(), 0);
+            for (int position = lenData - rleMatchLength * 2; position >= 0; --position)
+            {
+                if (std::equal(
+                    data.begin() + position,
+                    data.begin() + position + rleMatchLength,
+                    data.begin() + position + rleMatchLength))
+                {
+                    counts[position] = counts[position + rleMatchLength] + 1;
+                }
+            }
+        }
+
         // Work through the file backwards
         for (int position = lenData - 1; position >= 0; --position)
         {
@@ -102,37 +160,16 @@ namespace
             // First, we look for LZ matches. They tend to dominate the results (when possible, they are very cheap)
             // so doing them first helps avoid some wasted effort.
             // LZ run length is in the range 2..17 but also bounded by the number of bytes to the left and right
-            for (int length = 2; length < std::min(lenData - position, 17) + 1; ++length)
+            const int longest = matchFinder.find(position, nearestSource);
+            for (int length = MatchFinder::minLength; length <= longest; ++length)
             {
-                // Look for a match
-                const auto& r = std::ranges::find_end(
-                    data.begin() + std::max(0, position - 2047),
-                    data.begin() + position,
-                    data.begin() + position,
-                    data.begin() + position + length);
-                if (r.begin() != r.end())
-                {
-                    // We have a match
-                    // LZ matches are always 2 bytes
-                    auto cost = 2;
-                    if (position + length < lenData)
-                    {
-                        cost += bestMatches[position + length].costToEnd;
-                    }
-                    if (cost < bestMatches[position].costToEnd)
-                    {
-                        bestMatches[position].costToEnd = cost;
-                        bestMatches[position].mode = Match::Modes::Lz;
-                        bestMatches[position].length = length;
-                        bestMatches[position].extra = position - std::distance(data.begin(), r.begin());
-                    }
-                }
-                else
-                {
-                    // We try short lengths because they might have a cheaper total cost, but if we failed to find any 
-                    // match at length n, length n+1 will fail too
-                    break;
-                }
+                // LZ matches are always 2 bytes
+                parser.offer(
+                    position,
+                    Format::Token::Lz,
+                    length,
+                    position - nearestSource[length],
+                    2 + parser.costToEnd(position + length));
             }
 
             // Next an RLE match...
@@ -144,95 +181,86 @@ namespace
                     // Won't be true for higher rleMatchLength values either
                     break;
                 }
-                // Grab the sequence
-                const auto& rleSequence = std::ranges::subrange(
-                    data.begin() + position,
-                    data.begin() + position + rleMatchLength);
-                auto rleCount = 1;
-                // Check for matches
-                for (int matchPosition = position + rleMatchLength;
-                     matchPosition < std::min(lenData - rleMatchLength, position + rleMatchLength * 2047);
-                     matchPosition += rleMatchLength)
+                // Walk through the repeats, up to the max count the decompressor accepts. The final byte of the data
+                // is never included.
+                const int maxCount = std::min(1 + repeats[rleMatchLength][position], 2047);
+                for (int rleCount = 2; rleCount <= maxCount; ++rleCount)
                 {
-                    // Does it match?
-                    if (std::ranges::equal(
-                        data.begin() + matchPosition,
-                        data.begin() + matchPosition + rleMatchLength,
-                        rleSequence.begin(),
-                        rleSequence.end()))
-                    {
-                        // Yes, so what's our cost?
-                        ++rleCount;
-                        // RLE costs 1 byte + the sequence for counts up to 9, and 2 bytes + the sequence for counts
-                        // up to 2050 - but the decompressor only wants up to 2047
-                        int cost;
-                        if (rleCount <= 9)
-                        {
-                            cost = 1 + rleMatchLength;
-                        }
-                        else if (rleCount <= 2047)
-                        {
-                            cost = 2 + rleMatchLength;
-                        }
-                        else
-                        {
-                            // Over the max length
-                            continue;
-                        }
-                        if (matchPosition + rleMatchLength < lenData)
-                        {
-                            cost += bestMatches[matchPosition + rleMatchLength].costToEnd;
-                        }
-                        if (cost < bestMatches[position].costToEnd)
-                        {
-                            bestMatches[position].costToEnd = cost;
-                            bestMatches[position].mode = Match::Modes::Rle;
-                            bestMatches[position].length = rleMatchLength;
-                            bestMatches[position].extra = rleCount;
-                            bestMatches[position].offset = position;
-                        }
-                    }
-                    else
+                    const int endPosition = position + rleCount * rleMatchLength;
+                    if (endPosition >= lenData)
                     {
-                        // Not a match, do not continue
                         break;
                     }
+                    // RLE costs 1 byte + the sequence for counts up to 9, and 2 bytes + the sequence for counts
+                    // up to 2050 - but the decompressor only wants up to 2047
+                    parser.offer(
+                        position,
+                        Format::Token::Rle,
+                        rleCount * rleMatchLength,
+                        rleCount,
+                        (rleCount <= 9 ? 1 : 2) + rleMatchLength + parser.costToEnd(endPosition));
                 }
             }
 
             // Finally raw matches...
-            for (int n = 1; n < std::min(64, lenData - position) + 1; ++n)
-            {
-                // A raw match will cost n+1 bytes
-                int cost = n + 1;
-                if (position + n < lenData)
-                {
-                    cost += bestMatches[position + n].costToEnd;
-                }
-                if (cost < bestMatches[position].costToEnd)
-                {
-                    bestMatches[position].costToEnd = cost;
-                    bestMatches[position].mode = Match::Modes::Raw;
-                    bestMatches[position].length = n;
-                    bestMatches[position].offset = position;
-                }
-            }
+            // A raw match will cost n+1 bytes
+            rawRunFinder.tryAt(position, parser);
         }
 
-        // Now we have filled our vector, and we can walk through the matches to populate our data.
+        // Now we have filled our vector, and we can walk through the matches to write our data.
         // First two bytes are the compressed data length, which is the same as the first cost.
-        std::vector<uint8_t> result;
-        result.push_back((bestMatches[0].costToEnd >> 0) & 0xff);
-        result.push_back((bestMatches[0].costToEnd >> 8) & 0xff);
+        sink.addByte((parser.costToEnd(0) >> 0) & 0xff);
+        sink.addByte((parser.costToEnd(0) >> 8) & 0xff);
 
-        auto position = 0;
-        while (position < lenData)
+        parser.trace([&](const int position, const Format::Token token, const int length, const int value)
         {
-            const auto& match = bestMatches[position];
-            position += match.writeTo(result, data);
-        }
+            switch (token)
+            {
+            case Format::Token::Rle:
+                {
+                    // value is the repeat count
+                    const auto sequenceLength = length / value;
+                    if (value <= 9)
+                    {
+                        sink.addByte(static_cast<uint8_t>(0b11000000 | ((sequenceLength - 1) << 3) | (value - 2)));
+                    }
+                    else
+                    {
+                        sink.addByte(
+                            static_cast<uint8_t>(0b11100000 | ((sequenceLength - 1) << 3) | ((value - 2) >> 8)));
+                        sink.addByte((value - 2) & 0xff);
+                    }
+                    sink.addBytes(data, position, sequenceLength);
+                }
+                break;
+            case Format::Token::Lz:
+                // value is the offset
+                sink.addByte(static_cast<uint8_t>(value >> 4));
+                sink.addByte(static_cast<uint8_t>(((value & 0b1111) << 4) | (length - 2)));
+                break;
+            case Format::Token::Raw:
+                sink.addByte(static_cast<uint8_t>(0b10000000 | (length - 1)));
+                sink.addBytes(data, position, length);
+                break;
+            case Format::Token::None:
+                throw std::runtime_error("Unexpected token");
+            }
+            // Stop once it can't fit
+            return !sink.isFull();
+        });
+    }
 
-        return result;
+    int32_t compress(
+        Context& context,
+        const uint8_t* pSource,
+        const uint32_t sourceLength,
+        uint8_t* pDestination,
+        const uint32_t destinationLength)
+    {
+        const auto& data = Utils::toVector(context, pSource, sourceLength);
+        OutputSink sink(pDestination, destinationLength);
+        compress(context, data, sink);
+        return sink.result();
     }
 }
 
@@ -242,7 +270,17 @@ extern "C" __declspec(dllexport) int32_t compressTiles(
     uint8_t* pDestination,
     const uint32_t destinationLength)
 {
-    const auto& data = Utils::toVector(pSource, numTiles * 32);
-    const auto& compressed = compress(data);
-    return Utils::copyToDestination(compressed, pDestination, destinationLength);
+    Context context;
+    return compress(context, pSource, numTiles * 32, pDestination, destinationLength);
+}
+
+// As compressTiles, but reusing memory from a context made by createContext()
+extern "C" __declspec(dllexport) int32_t compressTilesEx(
+    Context* pContext,
+    const uint8_t* pSource,
+    const uint32_t numTiles,
+    uint8_t* pDestination,
+    const uint32_t destinationLength)
+{
+    return compress(*pContext, pSource, numTiles * 32, pDestination, destinationLength);
 }
@@ -2,6 +2,7 @@
 #include <vector>
 #include <cstdint>
 
+#include "CompressTilesBatch.h"
 #include "utils.h"
 
 extern "C" __declspec(dllexport) const char* getName()
@@ -18,6 +19,20 @@ extern "C" __declspec(dllexport) const char* getExt()
     return "soniccompr";
 }
 
+// At worst, every row is unique. That costs an 8 byte header, the row data and a bitmask byte per tile.
+// We can't do tilemaps.
+extern "C" __declspec(dllexport) uint32_t getMaxCompressedSize(
+    const uint32_t uncompressedBytes,
+    const bool isTilemap)
+{
+    return isTilemap ? 0 : 8 + uncompressedBytes + uncompressedBytes / 32;
+}
+
+extern "C" __declspec(dllexport) int32_t getThreadSafety()
+{
+    return ThreadSafety::Reentrant;
+}
+
 void writeWord(std::vector<uint8_t>& buffer, const uint16_t word)
 {
     buffer.push_back((word >> 0) & 0xff);
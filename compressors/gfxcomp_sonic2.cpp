@@ -3,6 +3,7 @@
 #include <cstdint>
 #include <ranges>
 
+#include "CompressTilesBatch.h"
 #include "utils.h"
 
 extern "C" __declspec(dllexport) const char* getName()
@@ -19,6 +20,20 @@ extern "C" __declspec(dllexport) const char* getExt()
     return "sonic2compr";
 }
 
+// At worst, every tile is raw. That costs a 6 byte header, the tile data and two bits per tile.
+// We can't do tilemaps.
+extern "C" __declspec(dllexport) uint32_t getMaxCompressedSize(
+    const uint32_t uncompressedBytes,
+    const bool isTilemap)
+{
+    return isTilemap ? 0 : 6 + uncompressedBytes + (uncompressedBytes / 32 + 3) / 4;
+}
+
+extern "C" __declspec(dllexport) int32_t getThreadSafety()
+{
+    return ThreadSafety::Reentrant;
+}
+
 void writeWord(std::vector<uint8_t>& buffer, const uint16_t word)
 {
     buffer.push_back((word >> 0) & 0xff);
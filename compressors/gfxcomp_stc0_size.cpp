@@ -0,0 +1,12 @@
+#include <cstdint>
+
+// The STC0 plugin comes from its own repository, which doesn't export this, so we add it here.
+
+// From the decompressor: each group of up to four bytes costs a control byte, plus at most one byte for each of them.
+// Then there's a byte for the end marker. It doesn't do tilemaps.
+extern "C" __declspec(dllexport) uint32_t getMaxCompressedSize(
+    const uint32_t uncompressedBytes,
+    const bool isTilemap)
+{
+    return isTilemap ? 0 : (uncompressedBytes + 3) / 4 * 5 + 1;
+}
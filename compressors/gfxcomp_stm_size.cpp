@@ -0,0 +1,12 @@
+#include <cstdint>
+
+// The STM plugin comes from its own repository, which doesn't export this, so we add it here.
+
+// It doesn't do tiles, and its tilemap format isn't documented anywhere we can derive a worst case from, so we don't
+// give one.
+extern "C" __declspec(dllexport) uint32_t getMaxCompressedSize(
+    const uint32_t /*uncompressedBytes*/,
+    const bool /*isTilemap*/)
+{
+    return 0;
+}
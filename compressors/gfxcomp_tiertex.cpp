@@ -2,6 +2,7 @@
 #include <iterator>
 #include <ranges>
 
+#include "CompressTilesBatch.h"
 #include "utils.h"
 
 extern "C" __declspec(dllexport) const char* getName()
@@ -17,6 +18,22 @@ extern "C" __declspec(dllexport) const char* getExt()
     return "tiertexcompr";
 }
 
+// We pick the least common byte as the RLE marker, so it appears at most once per 256 bytes of data. Each appearance
+// costs two extra bytes, and we add a byte for the marker itself. Tilemaps are packed into 3 bytes per entry pair
+// before compression.
+extern "C" __declspec(dllexport) uint32_t getMaxCompressedSize(
+    const uint32_t uncompressedBytes,
+    const bool isTilemap)
+{
+    const auto packedBytes = isTilemap ? uncompressedBytes / 4 * 3 : uncompressedBytes;
+    return 1 + packedBytes + packedBytes / 256 * 2;
+}
+
+extern "C" __declspec(dllexport) int32_t getThreadSafety()
+{
+    return ThreadSafety::Reentrant;
+}
+
 namespace
 {
     std::vector<uint8_t> compress(const std::vector<uint8_t>& source, const int rleByte)
@@ -80,6 +97,11 @@ int32_t compressTiles(
             std::swap(result, vec);
         }
     }
+    if (result.size() > getMaxCompressedSize(numTiles * 32, false))
+    {
+        // Should not happen, but hosts rely on it
+        return ReturnValues::CannotCompress;
+    }
     return Utils::copyToDestination(result, pDestination, destinationLength);
 }
 
@@ -99,7 +121,7 @@ int32_t compressTilemap(
     }
     // Put data into a vector, packing the high bits
     std::vector<uint8_t> buffer;
-    for (auto* p = pSource; p < pSource + sourceLength; /* increment in loop */)
+    for (const auto* pEnd = pSource + sourceLength; pSource < pEnd; /* increment in loop */)
     {
         buffer.push_back(*pSource++);
         auto highBits = *pSource++ & 0xf;
@@ -118,5 +140,10 @@ int32_t compressTilemap(
             std::swap(result, vec);
         }
     }
+    if (result.size() > getMaxCompressedSize(static_cast<uint32_t>(sourceLength), true))
+    {
+        // Should not happen, but hosts rely on it
+        return ReturnValues::CannotCompress;
+    }
     return Utils::copyToDestination(result, pDestination, destinationLength);
 }
@@ -1,9 +1,15 @@
 #include <cstdint>
 
+#include "CompressionCache.h"
+#include "CompressTilesBatch.h"
 #include "utils.h"
 #include "upkr/upkr.h"
 
-int32_t compress(const uint8_t* pSource, const size_t sourceLength, uint8_t* pDestination, const size_t destinationLength)
+int32_t compressUncached(
+    const uint8_t* pSource,
+    const size_t sourceLength,
+    uint8_t* pDestination,
+    const size_t destinationLength)
 {
     const auto compressedSize = upkr_compress(
         pDestination, 
@@ -20,6 +26,25 @@ int32_t compress(const uint8_t* pSource, const size_t sourceLength, uint8_t* pDe
     return static_cast<int32_t>(compressedSize);
 }
 
+// Level 9 is slow, so we cache the results. Change the version if the level changes.
+int32_t compress(
+    const uint8_t* pSource,
+    const uint32_t sourceLength,
+    uint8_t* pDestination,
+    const uint32_t destinationLength)
+{
+    return CompressionCache::compress(
+        "upkr 9 v1",
+        pSource,
+        sourceLength,
+        pDestination,
+        destinationLength,
+        [&](uint8_t* pCacheDestination, const uint32_t cacheDestinationLength)
+        {
+            return compressUncached(pSource, sourceLength, pCacheDestination, cacheDestinationLength);
+        });
+}
+
 extern "C" __declspec(dllexport) const char* getName()
 {
     // A pretty name for this compression type
@@ -32,6 +57,20 @@ extern "C" __declspec(dllexport) const char* getExt()
     return "upkr";
 }
 
+// upkr's adaptive coder can spend up to 6 bits on each decoded bit, depending on how its probabilities have drifted,
+// so the only bound we could derive from the format is over 25 times the input. We don't give one.
+extern "C" __declspec(dllexport) uint32_t getMaxCompressedSize(
+    const uint32_t /*uncompressedBytes*/,
+    const bool /*isTilemap*/)
+{
+    return 0;
+}
+
+extern "C" __declspec(dllexport) int32_t getThreadSafety()
+{
+    return ThreadSafety::Reentrant;
+}
+
 extern "C" __declspec(dllexport) int32_t compressTiles(
     const uint8_t* pSource,
     const uint32_t numTiles,
@@ -1,5 +1,6 @@
 #include <cstdint>
 
+#include "CompressTilesBatch.h"
 #include "utils.h"
 
 extern "C" __declspec(dllexport) const char* getName()
@@ -12,16 +13,30 @@ extern "C" __declspec(dllexport) const char* getExt()
     return "wbcompr";
 }
 
+// At worst, each run is a single $00 or $ff, which has to be written as a 3 byte run. We then add a 2 byte terminator
+// for each bitplane. We write directly to the destination, so we require this much space up front.
+// We can't do tilemaps.
+extern "C" __declspec(dllexport) uint32_t getMaxCompressedSize(
+    const uint32_t uncompressedBytes,
+    const bool isTilemap)
+{
+    return isTilemap ? 0 : uncompressedBytes * 3 + 2 * 4;
+}
+
+extern "C" __declspec(dllexport) int32_t getThreadSafety()
+{
+    return ThreadSafety::Reentrant;
+}
+
 extern "C" __declspec(dllexport) int compressTiles(
     const uint8_t* pSource,
     const uint32_t numTiles,
     uint8_t* pDestination,
     const uint32_t destinationLength)
 {
-    if (destinationLength < numTiles * 32 * 3 + 2 * 4)
+    if (destinationLength < getMaxCompressedSize(numTiles * 32, false))
     {
         return ReturnValues::BufferTooSmall;
-        // Please give me more space for the data (up to 3 times the data size plus 2 bytes terminator per each bitplane)
     }
 
     int finalSize = 0;
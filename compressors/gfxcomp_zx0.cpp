@@ -1,7 +1,9 @@
 #include <cstdint> // uint8_t, etc
 #include <cstdlib> // free
 #include <memory>
+#include <mutex>
 
+#include "CompressTilesBatch.h"
 #include "utils.h"
 
 extern "C"
@@ -21,6 +23,21 @@ extern "C" __declspec(dllexport) const char* getExt()
     return "zx0";
 }
 
+// The optimal parse is never bigger than a single literal run, which costs a flag bit, an Elias gamma length of up
+// to 33 bits and the data, plus an 18 bit end marker.
+extern "C" __declspec(dllexport) uint32_t getMaxCompressedSize(
+    const uint32_t uncompressedBytes,
+    const bool /*isTilemap*/)
+{
+    return uncompressedBytes + 16;
+}
+
+// ZX0 writes its output via globals, so we only compress one thing at a time
+extern "C" __declspec(dllexport) int32_t getThreadSafety()
+{
+    return ThreadSafety::Serialised;
+}
+
 // The actual compressor function, calling into the zx0 code
 int32_t compress(
     const uint8_t* pSource,
@@ -28,6 +45,10 @@ int32_t compress(
     uint8_t* pDestination,
     const size_t destinationLength)
 {
+    // One at a time, as getThreadSafety() says
+    static std::mutex mutex;
+    const std::scoped_lock lock(mutex);
+
     const auto optimised = optimize(
         const_cast<unsigned char*>(pSource),
         static_cast<int>(sourceLength),
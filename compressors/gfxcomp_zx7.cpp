@@ -1,7 +1,10 @@
+#include <algorithm>
 #include <cstdint> // uint8_t, etc
 #include <cstdlib> // free
 #include <memory>
+#include <vector>
 
+#include "CompressTilesBatch.h"
 #include "utils.h"
 
 extern "C"
@@ -21,23 +24,72 @@ extern "C" __declspec(dllexport) const char* getExt()
     return "zx7";
 }
 
+// The optimal parse is never bigger than all literals, which cost 9 bits each (8 for the first), plus an 18 bit end
+// marker
+extern "C" __declspec(dllexport) uint32_t getMaxCompressedSize(
+    const uint32_t uncompressedBytes,
+    const bool /*isTilemap*/)
+{
+    return uncompressedBytes + (uncompressedBytes + 24) / 8;
+}
+
+extern "C" __declspec(dllexport) int32_t getThreadSafety()
+{
+    return ThreadSafety::Reentrant;
+}
+
+// The working memory for optimize(), which we keep in the context. min, max and matches are big fixed-size tables
+// which optimize() needs to be zeroed, so we keep them zeroed between calls by clearing only the entries each call used.
+struct OptimizeBuffers
+{
+    std::vector<size_t> min = std::vector<size_t>(MAX_OFFSET + 1);
+    std::vector<size_t> max = std::vector<size_t>(MAX_OFFSET + 1);
+    std::vector<size_t> matches = std::vector<size_t>(256 * 256);
+    std::vector<size_t> matchSlots;
+    std::vector<Optimal> optimal;
+};
+
 // The actual compressor function, calling into the zx7 code
 int32_t compress(
+    Context& context,
     const uint8_t* pSource,
     const size_t sourceLength,
     uint8_t* pDestination,
     const size_t destinationLength)
 {
-    const auto optimised = Utils::makeUniqueForMalloc(
-        optimize(
-            const_cast<unsigned char*>(pSource),
-            sourceLength,
-            0));
+    auto& buffers = context.get<OptimizeBuffers>();
+    // optimize() writes each match slot before it reads it, but it only sets the offset and length of the optimal
+    // entries which end a match, so those need clearing
+    if (buffers.matchSlots.size() < sourceLength)
+    {
+        buffers.matchSlots.resize(sourceLength);
+    }
+    buffers.optimal.assign(sourceLength, {});
+    optimize_with_buffers(
+        const_cast<unsigned char*>(pSource),
+        sourceLength,
+        0,
+        buffers.min.data(),
+        buffers.max.data(),
+        buffers.matches.data(),
+        buffers.matchSlots.data(),
+        buffers.optimal.data());
+
+    // Clear the table entries it used: matches is indexed by each pair of bytes in the input, and min and max by
+    // offsets, which are less than the input size
+    for (size_t i = 1; i < sourceLength; ++i)
+    {
+        buffers.matches[pSource[i - 1] << 8 | pSource[i]] = 0;
+    }
+    const auto offsetCount = std::min(sourceLength, buffers.min.size());
+    std::fill_n(buffers.min.begin(), offsetCount, 0);
+    std::fill_n(buffers.max.begin(), offsetCount, 0);
+
     std::size_t outputSize;
     long delta; // we don't care about this
     const auto pOutputData = Utils::makeUniqueForMalloc(
         compress(
-            optimised.get(),
+            buffers.optimal.data(),
             const_cast<unsigned char*>(pSource),
             sourceLength,
             0,
@@ -53,7 +105,8 @@ extern "C" __declspec(dllexport) int32_t compressTiles(
     uint8_t* pDestination,
     const uint32_t destinationLength)
 {
-    return compress(pSource, numTiles * 32, pDestination, destinationLength);
+    Context context;
+    return compress(context, pSource, numTiles * 32, pDestination, destinationLength);
 }
 
 extern "C" __declspec(dllexport) int32_t compressTilemap(
@@ -63,5 +116,29 @@ extern "C" __declspec(dllexport) int32_t compressTilemap(
     uint8_t* pDestination,
     const uint32_t destinationLength)
 {
-    return compress(pSource, width * height * 2, pDestination, destinationLength);
+    Context context;
+    return compress(context, pSource, width * height * 2, pDestination, destinationLength);
+}
+
+// As compressTiles, but reusing memory from a context made by createContext()
+extern "C" __declspec(dllexport) int32_t compressTilesEx(
+    Context* pContext,
+    const uint8_t* pSource,
+    const uint32_t numTiles,
+    uint8_t* pDestination,
+    const uint32_t destinationLength)
+{
+    return compress(*pContext, pSource, numTiles * 32, pDestination, destinationLength);
+}
+
+// As compressTilemap, but reusing memory from a context made by createContext()
+extern "C" __declspec(dllexport) int32_t compressTilemapEx(
+    Context* pContext,
+    const uint8_t* pSource,
+    const uint32_t width,
+    const uint32_t height,
+    uint8_t* pDestination,
+    const uint32_t destinationLength)
+{
+    return compress(*pContext, pSource, width * height * 2, pDestination, destinationLength);
 }
@@ -0,0 +1,116 @@
+// Compares MatchFinder against the find_end searches it replaces, for the window and length parameters of some of
+// the formats we implement.
+// Usage: matchfinder_benchmark <file> [<file> ...]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+#include "MatchFinder.h"
+
+namespace
+{
+    struct Format
+    {
+        const char* name;
+        int maxOffset;
+        int minLength;
+        int maxLength;
+        bool allowOverlap;
+    };
+
+    constexpr Format formats[] = {
+        {"GG Aleste", 256, 3, 130, true},
+        {"SIMS", 2047, 2, 17, false},
+        {"Shining Force Gaiden", 2048, 3, 34, true},
+    };
+
+    // Gets the nearest offset for every length at every position, by searching for each length in turn
+    std::vector<std::vector<int>> findWithFindEnd(const std::vector<uint8_t>& data, const Format& format)
+    {
+        const int size = static_cast<int>(data.size());
+        std::vector result(size, std::vector(format.maxLength + 1, 0));
+        for (int position = 0; position < size; ++position)
+        {
+            for (int length = format.minLength; length <= std::min(format.maxLength, size - position); ++length)
+            {
+                const auto& r = std::ranges::find_end(
+                    data.begin() + std::max(0, position - format.maxOffset),
+                    data.begin() + position + (format.allowOverlap ? length - 1 : 0),
+                    data.begin() + position,
+                    data.begin() + position + length);
+                if (r.begin() == r.end())
+                {
+                    break;
+                }
+                result[position][length] = position - static_cast<int>(std::distance(data.begin(), r.begin()));
+            }
+        }
+        return result;
+    }
+
+    // Gets the same from a MatchFinder
+    std::vector<std::vector<int>> findWithMatchFinder(const std::vector<uint8_t>& data, const Format& format)
+    {
+        const MatchFinder matchFinder(data, format.maxOffset, format.minLength, format.maxLength, format.allowOverlap);
+        const int size = static_cast<int>(data.size());
+        std::vector result(size, std::vector(format.maxLength + 1, 0));
+        for (int position = 0; position < size; ++position)
+        {
+            int length = format.minLength;
+            for (const auto& [longestLength, offset] : matchFinder.find(position))
+            {
+                for (; length <= longestLength; ++length)
+                {
+                    result[position][length] = offset;
+                }
+            }
+        }
+        return result;
+    }
+
+    template <typename F>
+    double timeInMilliseconds(F&& f)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        f();
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+}
+
+int main(const int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        printf("Usage: %s <file> [<file> ...]\n", argv[0]);
+        return 1;
+    }
+
+    auto failed = false;
+    for (const auto& format : formats)
+    {
+        double findEndTime = 0;
+        double matchFinderTime = 0;
+        for (int i = 1; i < argc; ++i)
+        {
+            std::ifstream file(argv[i], std::ios::binary);
+            const std::vector<uint8_t> data{std::istreambuf_iterator(file), {}};
+
+            std::vector<std::vector<int>> expected;
+            std::vector<std::vector<int>> actual;
+            findEndTime += timeInMilliseconds([&] { expected = findWithFindEnd(data, format); });
+            matchFinderTime += timeInMilliseconds([&] { actual = findWithMatchFinder(data, format); });
+            if (actual != expected)
+            {
+                printf("%s: results differ for %s\n", format.name, argv[i]);
+                failed = true;
+            }
+        }
+        printf("%-24s find_end %10.1f ms  MatchFinder %8.1f ms\n", format.name, findEndTime, matchFinderTime);
+    }
+    return failed ? 1 : 0;
+}
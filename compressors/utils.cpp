@@ -34,6 +34,22 @@ std::vector<uint8_t> Utils::toVector(const uint8_t* pBuffer, const uint32_t leng
     return {pBuffer, pBuffer + length};
 }
 
+namespace
+{
+    // The context's copy of the source data
+    struct SourceBuffer
+    {
+        std::vector<uint8_t> data;
+    };
+}
+
+std::vector<uint8_t>& Utils::toVector(Context& context, const uint8_t* pBuffer, const uint32_t length)
+{
+    auto& buffer = context.get<SourceBuffer>().data;
+    buffer.assign(pBuffer, pBuffer + length);
+    return buffer;
+}
+
 int32_t Utils::copyToDestination(const std::vector<uint8_t>& source, uint8_t* pDestination, const uint32_t destinationLength)
 {
     if (source.size() > destinationLength)
@@ -54,3 +70,18 @@ int32_t Utils::copyToDestination(const uint8_t* pSource, const uint32_t sourceLe
     return static_cast<int32_t>(sourceLength);
 }
 
+
+extern "C" __declspec(dllexport) int32_t getContextApiVersion()
+{
+    return Context::apiVersion;
+}
+
+extern "C" __declspec(dllexport) Context* createContext()
+{
+    return new Context();
+}
+
+extern "C" __declspec(dllexport) void destroyContext(const Context* pContext)
+{
+    delete pContext;
+}
@@ -1,8 +1,38 @@
 #pragma once
 #include <cstdint>
 #include <memory>
+#include <typeindex>
+#include <unordered_map>
 #include <vector>
 
+// Working memory which a host can keep between calls, so compressors can reuse their buffers across many assets
+// instead of allocating them each time. Hosts get one from createContext() and pass it to compressTilesEx() or
+// compressTilemapEx(), which plugins may export alongside compressTiles() and compressTilemap(). A context may only be
+// used by one call at a time, so a host would typically keep one per worker thread, and it may only be used with the
+// plugin that created it.
+class Context
+{
+public:
+    // The version of the context exports, as returned by getContextApiVersion()
+    static constexpr int32_t apiVersion = 1;
+
+    // Gets this context's object of type T, default-constructing it on first use.
+    // Compressors use their own types here to hold whatever they want to reuse.
+    template <typename T>
+    T& get()
+    {
+        auto& pObject = _objects[std::type_index(typeid(T))];
+        if (!pObject)
+        {
+            pObject = std::make_shared<T>();
+        }
+        return *static_cast<T*>(pObject.get());
+    }
+
+private:
+    std::unordered_map<std::type_index, std::shared_ptr<void>> _objects;
+};
+
 class Utils
 {
 public:
@@ -12,6 +42,10 @@ public:
     // Convert pointer + length to a vector
     static std::vector<uint8_t> toVector(const uint8_t* pBuffer, uint32_t length);
 
+    // Copy pointer + length to a vector belonging to the context. This is overwritten by the next call with the same
+    // context.
+    static std::vector<uint8_t>& toVector(Context& context, const uint8_t* pBuffer, uint32_t length);
+
     // Emit vector to pointer, safely
     [[nodiscard]]
     static int32_t copyToDestination(const std::vector<uint8_t>& source, uint8_t* pDestination, uint32_t destinationLength);
@@ -32,3 +66,20 @@ public:
     static constexpr int32_t CannotCompress = -1;
     static constexpr int32_t BufferTooSmall = 0;
 };
+
+// Plugins also export getMaxCompressedSize(uncompressedBytes, isTilemap), which gives the most that compressTiles() (or
+// compressTilemap(), if isTilemap is true) will write for that much data. A host can then allocate the destination once
+// and never see BufferTooSmall. It returns 0 if the plugin can't compress that kind of data, or can't know.
+
+// Values for getThreadSafety(), which plugins export to tell hosts whether they can compress on several threads at
+// once. Hosts should assume None if it is missing.
+class ThreadSafety
+{
+public:
+    // Calls must not overlap
+    static constexpr int32_t None = 0;
+    // Calls may come from several threads, but the plugin only does one at a time
+    static constexpr int32_t Serialised = 1;
+    // Calls may run in parallel, each with its own Context if using the Ex exports
+    static constexpr int32_t Reentrant = 2;
+};
@@ -28,43 +28,46 @@
 
 #include "zx7.h"
 
-unsigned char* output_data;
-size_t output_index;
-size_t bit_index;
-int bit_mask;
-long diff;
-
-void read_bytes(int n, long *delta) {
-    diff += n;
-    if (diff > *delta)
-        *delta = diff;
+/* Output state, kept per call so compress() is reentrant */
+typedef struct writer_t {
+    unsigned char* output_data;
+    size_t output_index;
+    size_t bit_index;
+    int bit_mask;
+    long diff;
+} Writer;
+
+static void read_bytes(Writer *w, int n, long *delta) {
+    w->diff += n;
+    if (w->diff > *delta)
+        *delta = w->diff;
 }
 
-void write_byte(int value) {
-    output_data[output_index++] = (unsigned char)value;
-    diff--;
+static void write_byte(Writer *w, int value) {
+    w->output_data[w->output_index++] = (unsigned char)value;
+    w->diff--;
 }
 
-void write_bit(int value) {
-    if (bit_mask == 0) {
-        bit_mask = 128;
-        bit_index = output_index;
-        write_byte(0);
+static void write_bit(Writer *w, int value) {
+    if (w->bit_mask == 0) {
+        w->bit_mask = 128;
+        w->bit_index = w->output_index;
+        write_byte(w, 0);
     }
     if (value > 0) {
-        output_data[bit_index] |= bit_mask;
+        w->output_data[w->bit_index] |= w->bit_mask;
     }
-    bit_mask >>= 1;
+    w->bit_mask >>= 1;
 }
 
-void write_elias_gamma(int value) {
+static void write_elias_gamma(Writer *w, int value) {
     int i;
 
     for (i = 2; i <= value; i <<= 1) {
-        write_bit(0);
+        write_bit(w, 0);
     }
     while ((i >>= 1) > 0) {
-        write_bit(value & i);
+        write_bit(w, value & i);
     }
 }
 
@@ -74,18 +77,20 @@ unsigned char *compress(Optimal *optimal, unsigned char *input_data, size_t inpu
     int offset1;
     int mask;
     int i;
+    Writer writer;
+    Writer *w = &writer;
 
     /* calculate and allocate output buffer */
     input_index = input_size - 1;
     *output_size = (optimal[input_index].bits + 18 + 7) / 8;
-    output_data = (unsigned char *)malloc(*output_size);
-    if (!output_data) {
+    w->output_data = (unsigned char *)malloc(*output_size);
+    if (!w->output_data) {
         fprintf(stderr, "Error: Insufficient memory\n");
         exit(1);
     }
 
     /* initialize delta */
-    diff = *output_size - input_size + skip;
+    w->diff = *output_size - input_size + skip;
     *delta = 0;
 
     /* un-reverse optimal sequence */
@@ -96,57 +101,57 @@ unsigned char *compress(Optimal *optimal, unsigned char *input_data, size_t inpu
         input_index = input_prev;
     }
 
-    output_index = 0;
-    bit_mask = 0;
+    w->output_index = 0;
+    w->bit_mask = 0;
 
     /* first byte is always literal */
-    write_byte(input_data[input_index]);
-    read_bytes(1, delta);
+    write_byte(w, input_data[input_index]);
+    read_bytes(w, 1, delta);
 
     /* process remaining bytes */
     while ((input_index = optimal[input_index].bits) > 0) {
         if (optimal[input_index].len == 0) {
 
             /* literal indicator */
-            write_bit(0);
+            write_bit(w, 0);
 
             /* literal value */
-            write_byte(input_data[input_index]);
-            read_bytes(1, delta);
+            write_byte(w, input_data[input_index]);
+            read_bytes(w, 1, delta);
 
         }
         else {
 
             /* sequence indicator */
-            write_bit(1);
+            write_bit(w, 1);
 
             /* sequence length */
-            write_elias_gamma(optimal[input_index].len - 1);
+            write_elias_gamma(w, optimal[input_index].len - 1);
 
             /* sequence offset */
             offset1 = optimal[input_index].offset - 1;
             if (offset1 < 128) {
-                write_byte(offset1);
+                write_byte(w, offset1);
             }
             else {
                 offset1 -= 128;
-                write_byte((offset1 & 127) | 128);
+                write_byte(w, (offset1 & 127) | 128);
                 for (mask = 1024; mask > 127; mask >>= 1) {
-                    write_bit(offset1 & mask);
+                    write_bit(w, offset1 & mask);
                 }
             }
-            read_bytes(optimal[input_index].len, delta);
+            read_bytes(w, optimal[input_index].len, delta);
         }
     }
 
     /* sequence indicator */
-    write_bit(1);
+    write_bit(w, 1);
 
     /* end marker > MAX_LEN */
     for (i = 0; i < 16; i++) {
-        write_bit(0);
+        write_bit(w, 0);
     }
-    write_bit(1);
+    write_bit(w, 1);
 
-    return output_data;
+    return w->output_data;
 }
@@ -49,13 +49,6 @@ Optimal* optimize(unsigned char *input_data, size_t input_size, long skip) {
     size_t *matches;
     size_t *match_slots;
     Optimal *optimal;
-    size_t *match;
-    int match_index;
-    int offset;
-    size_t len;
-    size_t best_len;
-    size_t bits;
-    size_t i;
 
     /* allocate all data structures at once */
     min = (size_t *)calloc(MAX_OFFSET + 1, sizeof(size_t));
@@ -69,6 +62,28 @@ Optimal* optimize(unsigned char *input_data, size_t input_size, long skip) {
         exit(1);
     }
 
+    optimize_with_buffers(input_data, input_size, skip, min, max, matches, match_slots, optimal);
+
+    /* free everything except the return value */
+    free(match_slots);
+    free(min);
+    free(max);
+    free(matches);
+
+    return optimal;
+}
+
+/* as optimize(), but using buffers supplied by the caller, which must be zeroed: min and max have MAX_OFFSET + 1
+   entries, matches has 256 * 256, and match_slots and optimal have input_size */
+void optimize_with_buffers(unsigned char *input_data, size_t input_size, long skip, size_t *min, size_t *max, size_t *matches, size_t *match_slots, Optimal *optimal) {
+    size_t *match;
+    int match_index;
+    int offset;
+    size_t len;
+    size_t best_len;
+    size_t bits;
+    size_t i;
+
     /* index skipped bytes */
     for (i = 1; i <= (size_t)skip; i++) {
         match_index = input_data[i - 1] << 8 | input_data[i];
@@ -118,12 +133,4 @@ Optimal* optimize(unsigned char *input_data, size_t input_size, long skip) {
         match_slots[i] = matches[match_index];
         matches[match_index] = i;
     }
-
-    /* free everything except the return value */
-    free(match_slots);
-    free(min);
-    free(max);
-    free(matches);
-
-    return optimal;
 }
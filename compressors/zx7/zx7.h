@@ -35,4 +35,6 @@ typedef struct optimal_t {
 
 Optimal *optimize(unsigned char *input_data, size_t input_size, long skip);
 
+void optimize_with_buffers(unsigned char *input_data, size_t input_size, long skip, size_t *min, size_t *max, size_t *matches, size_t *match_slots, Optimal *optimal);
+
 unsigned char *compress(Optimal *optimal, unsigned char *input_data, size_t input_size, long skip, size_t *output_size, long *delta);